@@ -1,6 +1,16 @@
 
 const char* attrs[] = {
   "value",
+  "curve",
+  "mode",
+  "zc",
+  "binding",
+  "engine",
+  "pulse_us",
+  "pulse_count",
+  "pulse_period_us",
+  "energy",
+  "half_cycles",
   NULL
 };
 
@@ -31,8 +31,15 @@ extern struct admin_def def;
 #include "ac_dimmer.h"
 #endif
 
+#define MAX_GPIO 1024
+#define MAX_LINE 1024
+
 static void usage_error(char **argv) {
-  fprintf(stderr, "usage: %s {export|unexport} <gpio>\n", argv[0]);
+  fprintf(stderr, "usage: %s {export|unexport|allow} <gpio list>...\n", argv[0]);
+  fprintf(stderr, "       %s -f <config file>\n", argv[0]);
+  fprintf(stderr, "gpio list: comma separated pins or ranges, eg: 4,5,17-22\n");
+  fprintf(stderr, "allow: only give access to pins already exported (eg: by module parameters)\n");
+  fprintf(stderr, "config file: one '{export|unexport|allow} <gpio list>' per line, '#' starts a comment\n");
   exit(1);
 }
 
@@ -82,24 +89,54 @@ static void allow_access_by_user(unsigned int pin, const char *attr_name) {
   }
 }
 
-static unsigned int parse_gpio_pin(const char *pin_str) {
-  char *endp;
+static unsigned int parse_gpio_pin(const char *pin_str, char **endp) {
   unsigned int pin;
 
-  if (pin_str[0] == '\0') {
-    error(2, 0, "empty string given for GPIO pin number");
+  if (pin_str[0] < '0' || pin_str[0] > '9') {
+    error(2, 0, "%s is not a valid GPIO pin number", pin_str);
   }
 
-  pin = strtoul(pin_str, &endp, 0);
+  pin = strtoul(pin_str, endp, 10);
 
-  if (*endp != '\0') {
-    error(2, 0, "%s is not a valid GPIO pin number", pin_str);
+  if (pin >= MAX_GPIO) {
+    error(2, 0, "%u is not a valid GPIO pin number", pin);
   }
 
   return pin;
 }
 
-static void write_pin_to_export(const char *export, unsigned int pin) {
+/* Parse a list such as "4,5,17-22", same syntax as the drivers */
+static void parse_gpio_list(const char *list_str, unsigned char *pins) {
+  const char *str = list_str;
+  char *endp;
+  unsigned int first, last, pin;
+
+  if (str[0] == '\0') {
+    error(2, 0, "empty string given for GPIO pin list");
+  }
+
+  for (;;) {
+    first = last = parse_gpio_pin(str, &endp);
+    if (*endp == '-') {
+      last = parse_gpio_pin(endp + 1, &endp);
+    }
+
+    if (last < first || (*endp != ',' && *endp != '\0')) {
+      error(2, 0, "%s is not a valid GPIO pin list", list_str);
+    }
+
+    for (pin = first; pin <= last; ++pin) {
+      pins[pin] = 1;
+    }
+
+    if (*endp == '\0') {
+      break;
+    }
+    str = endp + 1;
+  }
+}
+
+static void write_list_to_export(const char *export, const char *list) {
   char path[PATH_MAX];
   int size = snprintf(path, PATH_MAX, "/sys/class/%s/%s",
     def.class, export);
@@ -114,8 +151,8 @@ static void write_pin_to_export(const char *export, unsigned int pin) {
     error(3, errno, "could not open %s", path);
   }
 
-  if (fprintf(out, "%u\n", pin) < 0) {
-    error(4, errno, "could not write GPIO pin number to %s", path);
+  if (fprintf(out, "%s\n", list) < 0) {
+    error(4, errno, "could not write GPIO pin list to %s", path);
   }
 
   if (fclose(out) == EOF) {
@@ -123,28 +160,119 @@ static void write_pin_to_export(const char *export, unsigned int pin) {
   }
 }
 
-int main(int argc, char **argv) {
-  if (argc != 3) {
+/* All pins of a command are written at once, the drivers claim them together */
+static void run_command(char **argv, const char *command, const char *list) {
+  unsigned char pins[MAX_GPIO];
+  unsigned int pin;
+
+  memset(pins, 0, sizeof(pins));
+  parse_gpio_list(list, pins);
+
+  if (strcmp(command, "export") == 0 || strcmp(command, "allow") == 0) {
+    if (strcmp(command, "export") == 0) {
+      write_list_to_export("export", list);
+    }
+    for (pin = 0; pin < MAX_GPIO; ++pin) {
+      if (!pins[pin]) {
+        continue;
+      }
+      for(const char **attr = def.attrs; *attr; ++attr) {
+        allow_access_by_user(pin, *attr);
+      }
+    }
+  }
+  else if (strcmp(command, "unexport") == 0) {
+    write_list_to_export("unexport", list);
+  }
+  else {
     usage_error(argv);
   }
+}
+
+/* The tool is installed setuid/setgid root : the config file is opened
+ * with the real ids, so that it cannot be used to read other files.
+ */
+static FILE *open_as_caller(const char *file) {
+  uid_t euid = geteuid();
+  gid_t egid = getegid();
+  FILE *in;
+  int errnum;
+
+  if (setegid(getgid()) != 0 || seteuid(getuid()) != 0) {
+    error(3, errno, "could not drop privileges");
+  }
+
+  in = fopen(file, "r");
+  errnum = errno;
+
+  if (seteuid(euid) != 0 || setegid(egid) != 0) {
+    error(3, errno, "could not restore privileges");
+  }
 
-  const char *command = argv[1];
-  const char *pin_str = argv[2];
+  errno = errnum;
+  return in;
+}
+
+static void run_config_file(char **argv, const char *file) {
+  char line[MAX_LINE];
+  char command[MAX_LINE];
+  char list[MAX_LINE];
+  char extra;
+  unsigned int line_number = 0;
+  char *comment;
 
-  unsigned int pin = parse_gpio_pin(pin_str);
+  FILE *in = open_as_caller(file);
+
+  if (in == NULL) {
+    error(3, errno, "could not open %s", file);
+  }
+
+  while (fgets(line, sizeof(line), in)) {
+    ++line_number;
+
+    comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
 
-  if (strcmp(command, "export") == 0) {
-    write_pin_to_export("export", pin);
-    for(const char **attr = def.attrs; *attr; ++attr) {
-      allow_access_by_user(pin, *attr);
+    switch (sscanf(line, "%s %s %c", command, list, &extra)) {
+    case EOF:
+      continue;
+    case 2:
+      run_command(argv, command, list);
+      break;
+    default:
+      error(2, 0, "%s:%u: invalid line", file, line_number);
     }
   }
-  else if (strcmp(command, "unexport") == 0) {
-    write_pin_to_export("unexport", pin);
+
+  fclose(in);
+}
+
+int main(int argc, char **argv) {
+  char list[MAX_LINE];
+  size_t size = 0;
+  int arg;
+
+  if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+    run_config_file(argv, argv[2]);
+    return 0;
   }
-  else {
+
+  if (argc < 3) {
     usage_error(argv);
   }
 
+  // several lists on the command line are merged into one
+  list[0] = '\0';
+  for (arg = 2; arg < argc; ++arg) {
+    size += snprintf(list + size, sizeof(list) - size, "%s%s", size ? "," : "", argv[arg]);
+    if (size >= sizeof(list)) {
+      error(7, 0, "gpio list too long!");
+    }
+  }
+
+  run_command(argv, argv[1], list);
+
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,163 @@
+#!/bin/sh
+# Dimmer firing and button benchmark without hardware, on the 4.9 kernels
+# the drivers are built for : dimmers and buttons are exported on the lines
+# of a gpio-mockup chip, mains is the virtual detector at 50Hz, buttons are
+# claimed without interrupt and pressed from debugfs.
+# For each channel count, reports the firing delay percentiles (merged
+# jitter histograms of all dimmers), the crossing dispatch time and the
+# button press detection latency (average and worst of all presses).
+#
+# usage : [ENGINES=<count>] bench.sh <seconds> <csv|json> <buttons> <channel count>...
+# dimmers are spread across ENGINES firing timers (1 by default)
+# needs root, debugfs, gpio-mockup and the GPIO sysfs interface
+
+set -e
+
+SECONDS_PER_RUN=$1
+FORMAT=$2
+BUTTONS=$3
+shift 3
+
+DEBUGFS=/sys/kernel/debug
+MAX_CHANNELS=0
+for n in "$@"; do
+	[ "$n" -gt "$MAX_CHANNELS" ] && MAX_CHANNELS=$n
+done
+
+cleanup()
+{
+	rmmod ac_button 2> /dev/null || true
+	rmmod ac_dimmer 2> /dev/null || true
+	rmmod ac_zc 2> /dev/null || true
+	rmmod gpio-mockup 2> /dev/null || true
+}
+trap cleanup EXIT
+
+cleanup
+# one chip, dimmer lines first then button lines
+modprobe gpio-mockup gpio_mockup_ranges=-1,$((MAX_CHANNELS + BUTTONS))
+
+BASE=
+for chip in /sys/class/gpio/gpiochip*; do
+	if [ "$(cat $chip/label)" = gpio-mockup-A ]; then
+		BASE=$(cat $chip/base)
+	fi
+done
+[ -n "$BASE" ] || { echo "gpio-mockup chip not found in /sys/class/gpio" >&2; exit 1; }
+BUTTON_GPIOS=
+[ "$BUTTONS" -gt 0 ] && BUTTON_GPIOS=$((BASE + MAX_CHANNELS))-$((BASE + MAX_CHANNELS + BUTTONS - 1))
+
+modprobe ac_zc ac_zc_virtual_freq=50000
+modprobe ac_button ac_button_virtual=1
+
+[ "$FORMAT" = json ] && printf "["
+SEP=
+for n in "$@"; do
+	rmmod ac_dimmer 2> /dev/null || true
+	modprobe ac_dimmer ac_dimmer_engines=${ENGINES:-1} ac_dimmer_gpios=$BASE-$((BASE + n - 1))
+
+	v=10
+	for f in /sys/class/ac_dimmer/dimmer*/value; do
+		echo $v > $f
+		v=$(( v % 90 + 7 ))
+	done
+
+	# exporting again resets the button latencies
+	if [ -n "$BUTTON_GPIOS" ]; then
+		echo $BUTTON_GPIOS > /sys/class/ac_button/unexport 2> /dev/null || true
+		echo $BUTTON_GPIOS > /sys/class/ac_button/export
+	fi
+
+	for f in $DEBUGFS/ac_dimmer/*/reset; do echo 1 > $f; done
+	echo 0 > /sys/class/ac_zc/dispatch_max
+
+	# press and release all buttons twice per second meanwhile, the latency
+	# of each press is read once it is reported
+	LATENCIES=
+	if [ -n "$BUTTON_GPIOS" ]; then
+		i=0
+		while [ $i -lt $((SECONDS_PER_RUN * 2)) ]; do
+			for f in $DEBUGFS/ac_button/*/press; do echo 1 > $f; done
+			sleep 0.3
+			for b in /sys/class/ac_button/button*; do
+				[ "$(cat $b/value)" = 1 ] && LATENCIES="$LATENCIES $(cut -d' ' -f1 $b/latency)"
+			done
+			for f in $DEBUGFS/ac_button/*/press; do echo 0 > $f; done
+			sleep 0.2
+			i=$((i + 1))
+		done
+		LATENCY_MAX=$(cat /sys/class/ac_button/button*/latency_max | sort -n | tail -n 1 | cut -d' ' -f1)
+	else
+		sleep $SECONDS_PER_RUN
+		LATENCY_MAX=0
+	fi
+
+	DISPATCH_AVG=$(cut -d' ' -f1 /sys/class/ac_zc/dispatch_avg)
+	DISPATCH_MAX=$(cut -d' ' -f1 /sys/class/ac_zc/dispatch_max)
+
+	# percentiles are the upper bound of the histogram bucket reaching them,
+	# the worst delay if that is the overflow one ; early firings count as 0
+	cat $DEBUGFS/ac_dimmer/*/jitter | awk -v channels=$n -v format=$FORMAT -v sep="$SEP" \
+		-v dispatch_avg=$DISPATCH_AVG -v dispatch_max=$DISPATCH_MAX \
+		-v latencies="$LATENCIES" -v latency_max=$LATENCY_MAX '
+		$1 == "on:" || $1 == "off:" {
+			level = substr($1, 1, length($1) - 1)
+			count[level] += $3
+			early[level] += $5
+			if(!(level in max) || $9 > max[level])
+				max[level] = $9
+			bucket = 0
+			next
+		}
+		$1 == "<" || $1 == ">=" {
+			hist[level, bucket] += $4
+			bound[bucket] = $1 == "<" ? $2 : -1
+			++bucket
+			buckets = bucket
+		}
+		function percentile(level, p,    b, sum)
+		{
+			sum = early[level]
+			if(sum >= p * count[level])
+				return 0
+			for(b = 0; b < buckets; ++b)
+			{
+				sum += hist[level, b]
+				if(sum >= p * count[level])
+					return bound[b] >= 0 ? bound[b] : int((max[level] + 999) / 1000)
+			}
+			return int((max[level] + 999) / 1000)
+		}
+		END {
+			presses = split(latencies, latency, " ")
+			latency_sum = 0
+			for(i = 1; i <= presses; ++i)
+				latency_sum += latency[i]
+			latency_avg = presses ? int(latency_sum / presses) : 0
+
+			if(format == "json")
+				printf "%s\n  { \"channels\": %d, \"dispatch_avg_ns\": %d, \"dispatch_max_ns\": %d, \"presses\": %d, \"latency_avg_ns\": %d, \"latency_max_ns\": %d",
+					sep, channels, dispatch_avg, dispatch_max, presses, latency_avg, latency_max
+			else if(sep == "")
+				print "channels,level,count,p50_us,p90_us,p99_us,p999_us,max_ns,dispatch_avg_ns,dispatch_max_ns,presses,latency_avg_ns,latency_max_ns"
+			split("on off", levels, " ")
+			for(i = 1; i <= 2; ++i)
+			{
+				l = levels[i]
+				if(format == "json")
+					printf ", \"%s\": { \"count\": %d, \"p50_us\": %d, \"p90_us\": %d, \"p99_us\": %d, \"p999_us\": %d, \"max_ns\": %d }",
+						l, count[l], percentile(l, 0.5), percentile(l, 0.9), percentile(l, 0.99), percentile(l, 0.999), max[l]
+				else
+					printf "%d,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", channels, l, count[l],
+						percentile(l, 0.5), percentile(l, 0.9), percentile(l, 0.99), percentile(l, 0.999), max[l],
+						dispatch_avg, dispatch_max, presses, latency_avg, latency_max
+			}
+			if(format == "json")
+				printf " }"
+		}'
+	SEP=,
+done
+if [ "$FORMAT" = json ]; then
+	echo
+	echo "]"
+fi
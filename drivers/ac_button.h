@@ -0,0 +1,22 @@
+#ifndef __MYLIFE_AC_BUTTON_H__
+#define __MYLIFE_AC_BUTTON_H__
+
+#define AC_BUTTON_STATUS_PRESS   (1 << 0)
+#define AC_BUTTON_STATUS_RELEASE (1 << 1)
+#define AC_BUTTON_STATUS_HOLD    (1 << 2) // each sampling interval while held, see AC_BUTTON_HOLD_DELAY
+
+// press duration before AC_BUTTON_STATUS_HOLD is reported (ns)
+#define AC_BUTTON_HOLD_DELAY 500000000
+
+// called from the button sampling timer (atomic context)
+typedef void (*ac_button_callback)(int status, void *data);
+
+// gpio does not need to be exported yet
+// return : id > 0 on success (to unregister), error < 0 on failure
+int ac_button_register(unsigned int gpio, int status, ac_button_callback cb, void *cb_data);
+
+// once it returns, the callback is not running anymore
+// return : 0 on success, error < 0 on failure
+int ac_button_unregister(int id);
+
+#endif // __MYLIFE_AC_BUTTON_H__
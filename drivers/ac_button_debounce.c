@@ -0,0 +1,57 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Debounce logic of the AC button, kept apart from GPIO and
+ * timer calls: sampling time is given by the caller.
+*/
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "ac_button_debounce.h"
+
+/* The first interrupt of a press starts its latency measurement */
+void button_edge(struct button_desc *desc, ktime_t now)
+{
+	if(desc->press_start.tv64 == 0)
+		desc->press_start = now;
+	desc->interrupted = 1;
+}
+
+/* An AC button interrupts on each half cycle while pressed, it is
+ * considered pressed after MIN_RANGE_COUNT contiguous intervals with
+ * interrupts, and released after the first interval without.
+ */
+int button_debounce(struct button_desc *desc, ktime_t now)
+{
+	int interrupted;
+	int value;
+
+	interrupted = desc->interrupted;
+	desc->interrupted = 0;
+
+	if(interrupted) {
+		++desc->interrupted_range_count;
+		value = desc->interrupted_range_count >= MIN_RANGE_COUNT ? 1 : 0;
+	} else {
+		value = desc->interrupted_range_count = 0;
+		desc->press_start = ktime_set(0,0);
+	}
+
+	if(value == desc->value)
+		return 0;
+
+	// changing
+	desc->value = value;
+	if(value)
+	{
+		++desc->presses;
+		desc->latency = ktime_to_ns(ktime_sub(now, desc->press_start));
+		if(desc->latency > desc->latency_max)
+			desc->latency_max = desc->latency;
+	}
+
+	return 1;
+}
@@ -0,0 +1,69 @@
+#ifndef __MYLIFE_AC_BUTTON_DEBOUNCE_H__
+#define __MYLIFE_AC_BUTTON_DEBOUNCE_H__
+
+#include <linux/ktime.h>
+
+struct device;
+struct dentry;
+struct gpio_desc;
+
+// count of contiguous sampling intervals with interrupts to report a press
+#define MIN_RANGE_COUNT 2
+
+/* button_desc
+ *
+ * This structure maintains the information regarding a
+ * single AC button
+ */
+struct button_desc
+{
+	// corresponding sysfs device
+	struct device   *dev;
+
+	// cached at export, avoids lookups from the IRQ handler
+	struct gpio_desc *gpiod;
+
+	// irq number
+	int irq;
+
+	// indicate if an interrupt occured between 50ms interval bounds
+	int interrupted;
+
+	// previous gpio value
+	int gpio_previous_value;
+
+	// count of contigus time range where an interrupt occured (avoid noise)
+	int interrupted_range_count;
+
+	// logical value
+	int value;
+
+	// first interrupt of the current press, and time it took to report the last one (ns)
+	ktime_t press_start;
+	u32 latency;
+	u32 latency_max;
+
+	// count of reported presses
+	u32 presses;
+
+	// last logical value change, for notification
+	ktime_t changed;
+
+	// simulated press entry
+	struct dentry *debugfs;
+
+	// FLAG_ACBUTTON for synchronizing inside module, FLAG_PRESSED while a simulated press is held
+	unsigned long flags;
+#define FLAG_ACBUTTON 1
+#define FLAG_NOTIFY   2
+#define FLAG_PRESSED  3
+};
+
+// Record an interrupt of a button at now
+void button_edge(struct button_desc *desc, ktime_t now);
+
+// Debounce a button over the sampling interval ending at now
+// return : 1 if its logical value changed, 0 otherwise
+int button_debounce(struct button_desc *desc, ktime_t now);
+
+#endif // __MYLIFE_AC_BUTTON_DEBOUNCE_H__
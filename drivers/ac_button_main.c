@@ -22,43 +22,33 @@
 #include <linux/irq.h>
 #include <linux/math64.h>
 #include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/workqueue.h>
+#include <linux/irq_work.h>
+#include <linux/debugfs.h>
+#include <net/genetlink.h>
 
 #include "ac_common.h"
-
-#define MIN_RANGE_COUNT 2
+#include "ac_button.h"
+#include "ac_button_debounce.h"
+#include "ac_user.h"
 
 static struct hrtimer hr_timer;
 static int timer_on = 0;
 
-/* button_desc
- *
- * This structure maintains the information regarding a
- * single AC button
- */
-struct button_desc
-{
-	// corresponding sysfs device
-	struct device   *dev;
-
-	// irq number
-	int irq;
-
-	// indicate if an interrupt occured between 50ms interval bounds
-	int interrupted;
+// CPU the timer is pinned to (-1 for any), and CPU of its last run
+static int timer_cpu = -1;
+static int timer_last_cpu = -1;
 
-	// previous gpio value
-	int gpio_previous_value;
+// buttons claimed at init, list such as "4,5,17-22"
+static char *ac_button_gpios = NULL;
 
-	// count of contigus time range where an interrupt occured (avoid noise)
-	int interrupted_range_count;
+// buttons claimed without interrupt, only simulated presses are seen
+static int ac_button_virtual = 0;
 
-	// logical value
-	int value;
-
-	// only FLAG_ACBUTTON is used, for synchronizing inside module
-	unsigned long flags;
-#define FLAG_ACBUTTON 1
-};
+// debugfs root, one directory per exported button
+static struct dentry *ac_button_debugfs = NULL;
 
 /* button_table
  *
@@ -73,14 +63,50 @@ static struct button_desc button_table[ARCH_NR_GPIOS];
  */
 static DEFINE_MUTEX(sysfs_lock);
 
+/* callbacks registered by other modules, protected by
+ * cb_lock against ac_button_register() / ac_button_unregister()
+ */
+struct ac_button_cb_desc
+{
+	unsigned int gpio;
+	int status; // 0 if free
+	ac_button_callback cb;
+	void *cb_data;
+};
+
+#define BUTTON_DESCRIPTOR_SIZE 32
+static struct ac_button_cb_desc cb_descriptors[BUTTON_DESCRIPTOR_SIZE];
+static DEFINE_RAW_SPINLOCK(cb_lock);
+
+// status page, mapped by /dev/ac_button_status readers, updated by the timer only
+static struct ac_button_status *status_page = NULL;
+
+static int ac_button_genl_get(struct sk_buff *skb, struct genl_info *info);
+static void ac_button_genl_event(struct button_desc *desc, ktime_t time, gfp_t flags);
+
+static int button_claim(unsigned int gpio);
+static int button_release(unsigned int gpio);
 static int button_export(unsigned int gpio);
 static int button_unexport(unsigned int gpio);
 static ssize_t button_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
 static ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t cpu_show(struct class *class, struct class_attribute *attr, char *buf);
+static ssize_t cpu_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t effective_cpu_show(struct class *class, struct class_attribute *attr, char *buf);
+static void button_debugfs_create(struct button_desc *desc);
+static void button_timer_start(void *info);
+static void button_timer_start_on(int cpu);
 
 static irqreturn_t ac_button_irq_handler(int irq, void *dev_id);
 static enum hrtimer_restart ac_button_hrtimer_callback(struct hrtimer *timer);
+static void button_notify(struct work_struct *work);
+static void button_notify_queue(struct irq_work *work);
+
+// userspace notifications, out of the sampling timer : queuing work
+// takes sleeping locks on PREEMPT_RT, it is done from an irq_work
+static DECLARE_WORK(notify_work, button_notify);
+static struct irq_work notify_irq_work;
 
 static int ac_button_init(void);
 static void ac_button_exit(void);
@@ -89,15 +115,56 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vincent TRUMPFF");
 MODULE_DESCRIPTION("Driver for AC button");
 
+module_param(ac_button_gpios, charp, 0444);
+MODULE_PARM_DESC(ac_button_gpios, "Button GPIO list exported at load, eg: 4,5,17-22");
+module_param(ac_button_virtual, int, 0444);
+MODULE_PARM_DESC(ac_button_virtual, "Claim buttons without interrupt (lines without one, such as gpio-mockup ones), presses are simulated from debugfs");
+
+EXPORT_SYMBOL(ac_button_register);
+EXPORT_SYMBOL(ac_button_unregister);
+
 module_init(ac_button_init);
 module_exit(ac_button_exit);
 
+/* Generic netlink family, see ac_user.h */
+static const struct nla_policy ac_button_genl_policy[AC_ATTR_MAX + 1] =
+{
+	[AC_ATTR_GPIO] = { .type = NLA_U32 },
+};
+
+static const struct genl_ops ac_button_genl_ops[] =
+{
+	{
+		.cmd    = AC_CMD_GET,
+		.doit   = ac_button_genl_get,
+		.policy = ac_button_genl_policy,
+	},
+};
+
+static const struct genl_multicast_group ac_button_genl_groups[] =
+{
+	{ .name = AC_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family ac_button_genl_family =
+{
+	.id      = GENL_ID_GENERATE,
+	.name    = AC_BUTTON_GENL_NAME,
+	.version = AC_GENL_VERSION,
+	.maxattr = AC_ATTR_MAX,
+	.module  = THIS_MODULE,
+};
+
 /* Sysfs attributes definition for buttons */
 static DEVICE_ATTR(value,   0444, button_show, NULL);
+static DEVICE_ATTR(latency, 0444, button_show, NULL);
+static DEVICE_ATTR(latency_max, 0444, button_show, NULL);
 
 static const struct attribute *ac_button_dev_attrs[] =
 {
 	&dev_attr_value.attr,
+	&dev_attr_latency.attr,
+	&dev_attr_latency_max.attr,
 	NULL,
 };
 
@@ -111,6 +178,8 @@ static struct class_attribute ac_button_class_attrs[] =
 {
 	__ATTR_WO(export),
 	__ATTR_WO(unexport),
+	__ATTR_RW(cpu),
+	__ATTR_RO(effective_cpu),
 	__ATTR_NULL,
 };
 static struct class ac_button_class =
@@ -134,6 +203,10 @@ ssize_t button_show(struct device *dev, struct device_attribute *attr, char *buf
 	{
 		if(strcmp(attr->attr.name, "value") == 0)
 			status = sprintf(buf, "%d\n", desc->value);
+		else if(strcmp(attr->attr.name, "latency") == 0)
+			status = sprintf(buf, "%u ns\n", desc->latency);
+		else if(strcmp(attr->attr.name, "latency_max") == 0)
+			status = sprintf(buf, "%u ns\n", desc->latency_max);
 		else
 			status = -EIO;
 	}
@@ -141,37 +214,249 @@ ssize_t button_show(struct device *dev, struct device_attribute *attr, char *buf
 	return status;
 }
 
-/* Export a GPIO pin to sysfs, and claim it for button usage.
+// return : id > 0 on success (to unregister), error < 0 on failure
+int ac_button_register(unsigned int gpio, int status, ac_button_callback cb, void *cb_data)
+{
+	int ret;
+	unsigned int index;
+	unsigned long flags;
+	struct ac_button_cb_desc *desc;
+
+	if(gpio >= ARCH_NR_GPIOS)
+		return -EINVAL;
+	if(status <= 0 || status > (AC_BUTTON_STATUS_PRESS | AC_BUTTON_STATUS_RELEASE | AC_BUTTON_STATUS_HOLD))
+		return -EINVAL;
+	if(!cb)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&cb_lock, flags);
+
+	ret = -EBUSY; // no empty place in array
+	for(index = 0; index < BUTTON_DESCRIPTOR_SIZE; ++index)
+	{
+		desc = cb_descriptors + index;
+		if(desc->status)
+			continue;
+
+		desc->gpio = gpio;
+		desc->cb = cb;
+		desc->cb_data = cb_data;
+		desc->status = status;
+
+		ret = index+1;
+		break;
+	}
+
+	raw_spin_unlock_irqrestore(&cb_lock, flags);
+
+	return ret;
+}
+
+int ac_button_unregister(int id)
+{
+	unsigned long flags;
+
+	if(id <= 0 || id > BUTTON_DESCRIPTOR_SIZE)
+		return -EINVAL;
+
+	// callbacks run under cb_lock
+	raw_spin_lock_irqsave(&cb_lock, flags);
+	cb_descriptors[id-1].status = 0;
+	raw_spin_unlock_irqrestore(&cb_lock, flags);
+
+	return 0;
+}
+
+/* Run callbacks registered on a button */
+static void button_callbacks(unsigned int gpio, int status)
+{
+	unsigned int index;
+	struct ac_button_cb_desc *desc;
+
+	raw_spin_lock(&cb_lock);
+	for(index = 0; index < BUTTON_DESCRIPTOR_SIZE; ++index)
+	{
+		desc = cb_descriptors + index;
+		if(desc->gpio == gpio && (desc->status & status))
+			desc->cb(status & desc->status, desc->cb_data);
+	}
+	raw_spin_unlock(&cb_lock);
+}
+
+/* Answer AC_CMD_GET with the current value of a button */
+int ac_button_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+	struct button_desc *desc;
+	struct sk_buff *msg;
+	u32 gpio;
+
+	if(!info->attrs[AC_ATTR_GPIO])
+		return -EINVAL;
+
+	gpio = nla_get_u32(info->attrs[AC_ATTR_GPIO]);
+	if(gpio >= ARCH_NR_GPIOS)
+		return -EINVAL;
+
+	desc = &button_table[gpio];
+	if(!test_bit(FLAG_ACBUTTON, &desc->flags))
+		return -ENODEV;
+
+	msg = ac_genl_event(&ac_button_genl_family, info->snd_portid, info->snd_seq, gpio, desc->value, ktime_get(), GFP_KERNEL);
+	if(!msg)
+		return -ENOMEM;
+
+	return genlmsg_reply(msg, info);
+}
+
+/* Multicast a button change, nobody listening is not an error */
+void ac_button_genl_event(struct button_desc *desc, ktime_t time, gfp_t flags)
+{
+	struct sk_buff *msg;
+
+	msg = ac_genl_event(&ac_button_genl_family, 0, 0, desc - button_table, desc->value, time, flags);
+	if(msg)
+		genlmsg_multicast(&ac_button_genl_family, msg, 0, 0, flags);
+}
+
+/* Export GPIO pins to sysfs, and claim them for button usage.
+ * Takes a list such as "4,5,17-22", either all pins are claimed or none.
  * See the equivalent function in drivers/gpio/gpiolib.c
  */
 ssize_t export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
 {
-	long gpio;
+	DECLARE_BITMAP(gpios, ARCH_NR_GPIOS);
+	unsigned int gpio;
+	unsigned int done;
 	int status;
-	int irq;
-	struct button_desc *desc;
 
-	status = kstrtol(buf, 0, &gpio);
+	status = ac_parse_gpio_list(buf, gpios);
 	if(status < 0)
 		goto fail_safe;
 
+	for_each_set_bit(gpio, gpios, ARCH_NR_GPIOS)
+	{
+		status = button_claim(gpio);
+		if(status < 0)
+			goto fail_after_claim;
+	}
+
+	return len;
+
+fail_after_claim:
+	for_each_set_bit(done, gpios, gpio)
+		button_release(done);
+fail_safe:
+	pr_debug("%s: status %d\n", __func__, status);
+	return status;
+}
+
+/* Unexport button GPIO pins from sysfs, and unreclaim them.
+ * Takes a list such as "4,5,17-22", pins not exported are reported
+ * as an error once the others are released.
+ * See the equivalent function in drivers/gpio/gpiolib.c
+ */
+ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	DECLARE_BITMAP(gpios, ARCH_NR_GPIOS);
+	unsigned int gpio;
+	int status;
+	int ret = 0;
+
+	status = ac_parse_gpio_list(buf, gpios);
+	if(status < 0)
+		goto done;
+
+	for_each_set_bit(gpio, gpios, ARCH_NR_GPIOS)
+	{
+		ret = button_release(gpio);
+		if(ret < 0)
+			status = ret;
+	}
+
+done:
+	if(status)
+		pr_debug("%s: status %d\n", __func__, status);
+	return status ? : len;
+}
+
+/* Show the CPU the sampling timer is pinned to, -1 for any */
+ssize_t cpu_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", timer_cpu);
+}
+
+/* Pin the sampling timer to a CPU, it is moved there right away */
+ssize_t cpu_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	int status;
+	int cpu;
+
+	status = ac_parse_cpu(buf, &cpu);
+	if(status < 0)
+		return status;
+
+	mutex_lock(&sysfs_lock);
+	timer_cpu = cpu;
+	if(timer_on && hrtimer_cancel(&hr_timer))
+		button_timer_start_on(cpu);
+	mutex_unlock(&sysfs_lock);
+
+	return len;
+}
+
+/* Show the CPU of the last sampling timer run */
+ssize_t effective_cpu_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", timer_last_cpu);
+}
+
+/* (Re)start the sampling timer, pinned to the current CPU if timer_cpu is set */
+void button_timer_start(void *info)
+{
+	hrtimer_start(&hr_timer, ktime_set(0, 50000000), timer_cpu < 0 ? HRTIMER_MODE_REL : HRTIMER_MODE_REL_PINNED); // 50ms
+}
+
+/* Start the sampling timer from a CPU (-1 for any). If that CPU went
+ * offline, it is started unpinned rather than left stopped.
+ */
+void button_timer_start_on(int cpu)
+{
+	if(cpu >= 0 && smp_call_function_single(cpu, button_timer_start, NULL, 1) == 0)
+		return;
+	hrtimer_start(&hr_timer, ktime_set(0, 50000000), HRTIMER_MODE_REL);
+}
+
+/* Claim a GPIO pin for button usage and start sampling it */
+int button_claim(unsigned int gpio)
+{
+	int status;
+	int irq;
+	struct button_desc *desc;
+
 	desc = &button_table[gpio];
 
 	status = gpio_request(gpio, "ac_button");
 	if(status < 0)
 		goto fail_safe;
 
-	status = gpio_direction_input(gpio);
-	if(status < 0)
-		goto fail_after_gpio;
+	desc->gpiod = gpio_to_desc(gpio);
 
-	status = irq = gpio_to_irq(gpio);
+	status = gpiod_direction_input(desc->gpiod);
 	if(status < 0)
 		goto fail_after_gpio;
 
-	status = request_irq(irq, ac_button_irq_handler, IRQ_TYPE_EDGE_BOTH/*IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING | IRQF_NO_THREAD*/, "ac_button_gpio_irq", desc);
-	if(status < 0)
-		goto fail_after_gpio;
+	irq = -1;
+	if(!ac_button_virtual)
+	{
+		status = irq = gpiod_to_irq(desc->gpiod);
+		if(status < 0)
+			goto fail_after_gpio;
+
+		// the handler only records the edge, it is kept in hard context for latency measurement
+		status = request_irq(irq, ac_button_irq_handler, IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING | IRQF_NO_THREAD, "ac_button_gpio_irq", desc);
+		if(status < 0)
+			goto fail_after_gpio;
+	}
 
 	status = button_export(gpio);
 	if(status < 0)
@@ -182,54 +467,41 @@ ssize_t export_store(struct class *class, struct class_attribute *attr, const ch
 
 	if(!timer_on)
 	{
-		hrtimer_start(&hr_timer, ktime_set(0, 50000000), HRTIMER_MODE_REL); // 50ms
 		timer_on = 1;
+		button_timer_start_on(timer_cpu);
 	}
 
-	return len;
+	return 0;
 
 fail_after_irq:
-	free_irq(irq, desc);
+	if(irq >= 0)
+		free_irq(irq, desc);
 fail_after_gpio:
-  gpio_free(gpio);
+	gpio_free(gpio);
 fail_safe:
-  pr_debug("%s: status %d\n", __func__, status);
-  return status;
+	pr_debug("%s: button%u status %d\n", __func__, gpio, status);
+	return status;
 }
 
-/* Unexport a button GPIO pin from sysfs, and unreclaim it.
- * See the equivalent function in drivers/gpio/gpiolib.c
- */
-ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+/* Stop sampling a button and unreclaim its GPIO pin */
+int button_release(unsigned int gpio)
 {
-	long gpio;
-	int  status;
+	int status;
 	struct button_desc *desc;
 
-	status = kstrtol(buf, 0, &gpio);
-	if(status < 0)
-		goto done;
-
-	status = -EINVAL;
-	if(!gpio_is_valid(gpio))
-		goto done;
-
 	desc = &button_table[gpio];
 
-	if(test_and_clear_bit(FLAG_ACBUTTON, &desc->flags))
+	if(!test_and_clear_bit(FLAG_ACBUTTON, &desc->flags))
+		return -EINVAL;
+
+	status = button_unexport(gpio);
+	if(status == 0)
 	{
-		status = button_unexport(gpio);
-		if(status == 0)
-		{
+		if(desc->irq >= 0)
 			free_irq(desc->irq, desc);
-			gpio_free(gpio);
-		}
+		gpio_free(gpio);
 	}
-
-done:
-	if(status)
-		pr_debug("%s: status %d\n", __func__, status);
-	return status ? : len;
+	return status;
 }
 
 /* Setup the sysfs directory for a claimed button device */
@@ -246,12 +518,20 @@ int button_export(unsigned int gpio)
 	desc->value = 0;
 	desc->gpio_previous_value = 0;
 	desc->interrupted_range_count = 0;
+	desc->press_start = ktime_set(0,0);
+	desc->latency = 0;
+	desc->latency_max = 0;
+	desc->presses = 0;
+	clear_bit(FLAG_PRESSED, &desc->flags);
 	desc->dev = dev = device_create(&ac_button_class, NULL, MKDEV(0, 0), desc, "button%d", gpio);
 	if(dev)
 	{
 		status = sysfs_create_group(&dev->kobj, &ac_button_dev_attr_group);
 		if(status == 0)
+		{
+			button_debugfs_create(desc);
 			printk(KERN_INFO "Registered device button%d\n", gpio);
+		}
 		else
 			device_unregister(dev);
 	}
@@ -280,6 +560,8 @@ int button_unexport(unsigned int gpio)
 	dev  = desc->dev;
 	if(dev)
 	{
+		debugfs_remove_recursive(desc->debugfs);
+		desc->debugfs = NULL;
 		device_unregister(dev);
 		printk(KERN_INFO "Unregistered device button%d\n", gpio);
 		status = 0;
@@ -298,7 +580,6 @@ int button_unexport(unsigned int gpio)
 
 irqreturn_t ac_button_irq_handler(int irq, void *dev_id)
 {
-	unsigned int gpio;
 	struct button_desc *desc;
 	int gpio_value;
 
@@ -309,28 +590,128 @@ irqreturn_t ac_button_irq_handler(int irq, void *dev_id)
 	if(desc >= &button_table[ARCH_NR_GPIOS])
 		return IRQ_NONE;
 
-	gpio = desc - button_table;
-
 	if(!test_bit(FLAG_ACBUTTON, &desc->flags))
 		return IRQ_NONE; // paranoia
 
-	gpio_value = gpio_get_value(gpio);
+	gpio_value = gpiod_get_raw_value(desc->gpiod);
 	if(gpio_value == desc->gpio_previous_value)
 		return IRQ_HANDLED;
 	desc->gpio_previous_value = gpio_value;
 
-	desc->interrupted = 1;
+	button_edge(desc, ktime_get());
 
 	return IRQ_HANDLED;
 }
 
+/* Writing 1 presses a button, 0 releases it : while held, it interrupts
+ * as on each half cycle, for benchmarking without button hardware.
+ */
+static ssize_t button_press_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	struct button_desc *desc = file->private_data;
+	unsigned long flags;
+	int status;
+	int value;
+
+	status = kstrtoint_from_user(buf, len, 0, &value);
+	if(status < 0)
+		return status;
+
+	if(value)
+	{
+		// in the place of the interrupt handler
+		local_irq_save(flags);
+		set_bit(FLAG_PRESSED, &desc->flags);
+		button_edge(desc, ktime_get());
+		local_irq_restore(flags);
+	}
+	else
+	{
+		clear_bit(FLAG_PRESSED, &desc->flags);
+	}
+
+	return len;
+}
+
+static const struct file_operations button_press_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = simple_open,
+	.write   = button_press_write,
+	.llseek  = no_llseek,
+};
+
+/* Create debugfs entries of a button, failures are not fatal */
+void button_debugfs_create(struct button_desc *desc)
+{
+	desc->debugfs = NULL;
+	if(IS_ERR_OR_NULL(ac_button_debugfs))
+		return;
+
+	desc->debugfs = debugfs_create_dir(dev_name(desc->dev), ac_button_debugfs);
+	if(IS_ERR_OR_NULL(desc->debugfs))
+		return;
+
+	debugfs_create_file("press", 0200, desc->debugfs, desc, &button_press_fops);
+}
+
+static int status_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return ac_status_mmap(vma, status_page);
+}
+
+static const struct file_operations status_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = nonseekable_open,
+	.mmap    = status_mmap,
+	.llseek  = no_llseek,
+};
+
+static struct miscdevice status_device =
+{
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "ac_button_status",
+	.fops  = &status_fops,
+};
+
+/* Notify userspace of button changes */
+void button_notify(struct work_struct *work)
+{
+	unsigned int gpio;
+	struct button_desc *desc;
+
+	mutex_lock(&sysfs_lock);
+	for(gpio = 0; gpio < ARCH_NR_GPIOS; ++gpio)
+	{
+		desc = &button_table[gpio];
+		if(!test_and_clear_bit(FLAG_NOTIFY, &desc->flags))
+			continue;
+		if(!test_bit(FLAG_ACBUTTON, &desc->flags))
+			continue;
+
+		sysfs_notify(&desc->dev->kobj, NULL, "value");
+		ac_button_genl_event(desc, desc->changed, GFP_KERNEL);
+	}
+	mutex_unlock(&sysfs_lock);
+}
+
+/* Buttons are debounced and published to the status page at each tick,
+ * bound actions are run from here, before userspace is notified.
+ */
 enum hrtimer_restart ac_button_hrtimer_callback(struct hrtimer *timer)
 {
 	unsigned int gpio;
 	struct button_desc *desc;
+	struct ac_button_status_button *entry;
+	unsigned int count = 0;
 	int restart_timer = 0;
-	int interrupted;
-	int value;
+	int notify = 0;
+	ktime_t now = ktime_get();
+
+	timer_last_cpu = smp_processor_id();
+
+	ac_status_write_begin(&status_page->seq);
 
 	for(gpio=0; gpio<ARCH_NR_GPIOS; gpio++)
 	{
@@ -338,31 +719,46 @@ enum hrtimer_restart ac_button_hrtimer_callback(struct hrtimer *timer)
 		if(!test_bit(FLAG_ACBUTTON, &desc->flags))
 			continue;
 
-		interrupted = desc->interrupted;
-		desc->interrupted = 0;
+		if(button_debounce(desc, now))
+		{
+			button_callbacks(gpio, desc->value ? AC_BUTTON_STATUS_PRESS : AC_BUTTON_STATUS_RELEASE);
 
-		if(interrupted) {
-			++desc->interrupted_range_count;
-			value = desc->interrupted_range_count >= MIN_RANGE_COUNT ? 1 : 0;
-		} else {
-			value = desc->interrupted_range_count = 0;
+			// notify change
+			desc->changed = now;
+			set_bit(FLAG_NOTIFY, &desc->flags);
+			notify = 1;
+		}
+		else if(desc->value && ktime_to_ns(ktime_sub(now, desc->press_start)) >= AC_BUTTON_HOLD_DELAY)
+		{
+			button_callbacks(gpio, AC_BUTTON_STATUS_HOLD);
 		}
 
-		if(value != desc->value)
+		// the half cycles of a held simulated press interrupt the next interval
+		if(test_bit(FLAG_PRESSED, &desc->flags))
+			button_edge(desc, now);
+
+		if(count < AC_STATUS_MAX_CHANNELS)
 		{
-			// changing
-			desc->value = value;
-			// notify change
-			sysfs_notify(&desc->dev->kobj, NULL, "value");
+			entry = &status_page->buttons[count++];
+			entry->gpio = gpio;
+			entry->value = desc->value;
+			entry->presses = desc->presses;
+			entry->latency = desc->latency;
 		}
 
 		restart_timer = 1;
 	}
 
+	status_page->count = count;
+	ac_status_write_end(&status_page->seq);
+
+	if(notify)
+		irq_work_queue(&notify_irq_work);
+
 	if(restart_timer)
 	{
 		// should use hrtimer_forward ?
-		hrtimer_start(&hr_timer, ktime_set(0, 50000000), HRTIMER_MODE_REL); // 50ms
+		button_timer_start(NULL);
 	}
 	else
 		timer_on = 0;
@@ -370,49 +766,71 @@ enum hrtimer_restart ac_button_hrtimer_callback(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+void button_notify_queue(struct irq_work *work)
+{
+	schedule_work(&notify_work);
+}
+
 int __init ac_button_init(void)
 {
 	int status;
 	printk(KERN_INFO "AC button v0.1 initializing.\n");
 
-	hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ac_hrtimer_init(&hr_timer, HRTIMER_MODE_REL);
 	hr_timer.function = &ac_button_hrtimer_callback;
+	init_irq_work(&notify_irq_work, button_notify_queue);
+
+	BUILD_BUG_ON(sizeof(struct ac_button_status) > PAGE_SIZE);
+	status_page = (struct ac_button_status *)get_zeroed_page(GFP_KERNEL);
+	if(!status_page)
+		return -ENOMEM;
 
 	status = class_register(&ac_button_class);
 	if(status < 0)
 		goto fail_no_class;
 
+	// debugfs is optional
+	ac_button_debugfs = debugfs_create_dir("ac_button", NULL);
+
+	status = misc_register(&status_device);
+	if(status < 0)
+		goto fail_after_class;
+
+	status = genl_register_family_with_ops_groups(&ac_button_genl_family, ac_button_genl_ops, ac_button_genl_groups);
+	if(status < 0)
+		goto fail_after_status;
+
+	// everything is ready, buttons are sampled from now on
+	ac_provision(ac_button_gpios, button_claim, "ac_button");
+
 	printk(KERN_INFO "AC button initialized.\n");
 	return 0;
 
+fail_after_status:
+	misc_deregister(&status_device);
+fail_after_class:
+	debugfs_remove_recursive(ac_button_debugfs);
+	class_unregister(&ac_button_class);
 fail_no_class:
+	free_page((unsigned long)status_page);
 	return status;
 }
 
 void __exit ac_button_exit(void)
 {
 	unsigned int gpio;
-	int status;
-	int irq;
 
+	misc_deregister(&status_device);
 	hrtimer_cancel(&hr_timer);
+	irq_work_sync(&notify_irq_work);
+	cancel_work_sync(&notify_work);
+	genl_unregister_family(&ac_button_genl_family);
 
 	for(gpio=0; gpio<ARCH_NR_GPIOS; gpio++)
-	{
-		struct button_desc *desc;
-		desc = &button_table[gpio];
-		if(test_bit(FLAG_ACBUTTON, &desc->flags))
-		{
-			irq = desc->irq;
-			status = button_unexport(gpio);
-			if(status == 0)
-			{
-				free_irq(irq, desc);
-				gpio_free(gpio);
-			}
-		}
-	}
+		button_release(gpio);
 
+	debugfs_remove_recursive(ac_button_debugfs);
 	class_unregister(&ac_button_class);
+	free_page((unsigned long)status_page);
 	printk(KERN_INFO "AC button disabled.\n");
 }
@@ -1,4 +1,148 @@
 #ifndef __MYLIFE_AC_COMMON_H__
 #define __MYLIFE_AC_COMMON_H__
 
+#include <linux/mm.h>
+#include <linux/hrtimer.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/bitmap.h>
+#include <linux/gpio.h>
+#include <linux/ktime.h>
+#include <net/genetlink.h>
+
+#include "ac_user.h"
+
+/* Timers firing GPIOs must run in hard interrupt context, also on
+ * PREEMPT_RT where timers default to softirq threads. Their callbacks
+ * only take raw spinlocks and defer anything else through an irq_work.
+ * The -rt patches of the supported kernels flag such timers irqsafe.
+ */
+static inline void ac_hrtimer_init(struct hrtimer *timer, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, CLOCK_MONOTONIC, mode);
+#ifdef CONFIG_PREEMPT_RT_FULL
+	timer->irqsafe = 1;
+#endif
+}
+
+/* Parse a cpu attribute: an online CPU number, or -1 for any CPU */
+static inline int ac_parse_cpu(const char *buf, int *cpu)
+{
+	int status;
+
+	status = kstrtoint(buf, 0, cpu);
+	if(status < 0)
+		return status;
+	if(*cpu == -1)
+		return 0;
+	if(*cpu < 0 || *cpu >= nr_cpu_ids || !cpu_online(*cpu))
+		return -EINVAL;
+	return 0;
+}
+
+/* Status page helpers, see ac_user.h for the reader side.
+ * Writers of a same seq must be serialized by the caller.
+ */
+static inline void ac_status_write_begin(__u32 *seq)
+{
+	WRITE_ONCE(*seq, *seq + 1);
+	smp_wmb();
+}
+
+static inline void ac_status_write_end(__u32 *seq)
+{
+	smp_wmb();
+	WRITE_ONCE(*seq, *seq + 1);
+}
+
+// map a status page (from get_zeroed_page) read-only
+static inline int ac_status_mmap(struct vm_area_struct *vma, void *page)
+{
+	if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE)
+		return -EINVAL;
+	if(vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(page) >> PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot);
+}
+
+/* Parse a GPIO list such as "4,5,17-22" (see bitmap_parselist)
+ * into a bitmap of ARCH_NR_GPIOS bits
+ */
+static inline int ac_parse_gpio_list(const char *buf, unsigned long *gpios)
+{
+	char *list;
+	int status;
+
+	list = kstrndup(buf, PAGE_SIZE, GFP_KERNEL);
+	if(!list)
+		return -ENOMEM;
+
+	status = bitmap_parselist(strim(list), gpios, ARCH_NR_GPIOS);
+	if(status == 0 && bitmap_empty(gpios, ARCH_NR_GPIOS))
+		status = -EINVAL;
+
+	kfree(list);
+	return status;
+}
+
+/* Claim the GPIO list given as module parameter at init,
+ * a pin that cannot be claimed does not prevent the others to work.
+ */
+static inline void ac_provision(const char *list, int (*claim)(unsigned int gpio), const char *name)
+{
+	DECLARE_BITMAP(gpios, ARCH_NR_GPIOS);
+	unsigned int gpio;
+	int status;
+
+	if(!list || !*list)
+		return;
+
+	status = ac_parse_gpio_list(list, gpios);
+	if(status < 0)
+	{
+		printk(KERN_WARNING "%s: invalid gpio list '%s'\n", name, list);
+		return;
+	}
+
+	for_each_set_bit(gpio, gpios, ARCH_NR_GPIOS)
+	{
+		status = claim(gpio);
+		if(status < 0)
+			printk(KERN_WARNING "%s: cannot claim gpio %u (%d)\n", name, gpio, status);
+	}
+}
+
+/* Build an AC_CMD_EVENT message (see ac_user.h)
+ * return : message to multicast or reply, NULL on failure
+ */
+static inline struct sk_buff *ac_genl_event(struct genl_family *family, u32 portid, u32 seq, u32 gpio, s32 value, ktime_t time, gfp_t flags)
+{
+	struct sk_buff *skb;
+	void *hdr;
+
+	skb = genlmsg_new(nla_total_size(sizeof(u32)) * 2 + nla_total_size(sizeof(u64)) * 2, flags);
+	if(!skb)
+		return NULL;
+
+	hdr = genlmsg_put(skb, portid, seq, family, 0, AC_CMD_EVENT);
+	if(!hdr)
+		goto fail_after_skb;
+
+	if(nla_put_u32(skb, AC_ATTR_GPIO, gpio)
+		|| nla_put_s32(skb, AC_ATTR_VALUE, value)
+		|| nla_put_u64_64bit(skb, AC_ATTR_TIME, ktime_to_ns(time), AC_ATTR_PAD))
+	{
+		genlmsg_cancel(skb, hdr);
+		goto fail_after_skb;
+	}
+
+	genlmsg_end(skb, hdr);
+	return skb;
+
+fail_after_skb:
+	nlmsg_free(skb);
+	return NULL;
+}
+
 #endif // __MYLIFE_AC_COMMON_H__
@@ -22,48 +22,178 @@
 #include <linux/irq.h>
 #include <linux/math64.h>
 #include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <net/genetlink.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/irq_work.h>
+#include <linux/cpumask.h>
 
 #include "ac_common.h"
 #include "ac_zc.h"
+#include "ac_button.h"
+#include "ac_dimmer_sched.h"
+#include "ac_dimmer_sr.h"
+#include "ac_user.h"
 
-static int ac_zc_id = -1;
+// dimmer_table entries : GPIO pins, then shift register outputs
+#define DIMMER_COUNT (ARCH_NR_GPIOS + DIMMER_SR_MAX_BITS)
+#define DIMMER_SR_INDEX(bit) (ARCH_NR_GPIOS + (bit))
+#define DIMMER_SR_BIT(index) ((index) - ARCH_NR_GPIOS)
 
-static struct hrtimer hr_timer;
-
-/* dimmer_desc
+/* dimmer_engine
  *
- * This structure maintains the information regarding a
- * single AC dimmer triac command signal:
- * value : 0 - 100
+ * A firing timer with its own run queue and lock. Channels are spread
+ * across engines, each pinned to its own CPU, so that dense firing
+ * patterns run in parallel instead of queuing behind each other.
+ * cpu      : CPU the timer is pinned to, -1 for any
+ * last_cpu : CPU of its last run
+ * arm_csd  : arms the timer from its CPU when armed from another one
  */
-struct dimmer_desc
+#define DIMMER_MAX_ENGINES 8
+struct dimmer_engine
 {
-	int value;
-	int gpio_value;
-	ktime_t next_tick;     // timer tick at which next toggling should happen
-	unsigned long flags;   // only FLAG_ACDIMMER is used, for synchronizing inside module
-#define FLAG_ACDIMMER 1
+	unsigned int index;
+	struct hrtimer timer;
+	raw_spinlock_t lock;
+	struct dimmer_run_queue run_queue;
+	int cpu;
+	int last_cpu;
+	struct call_single_data arm_csd;
+	unsigned long flags;
+#define FLAG_ARM_PENDING 0
+};
+
+static struct dimmer_engine engines[DIMMER_MAX_ENGINES];
+static struct dimmer_desc *run_queue_items[DIMMER_MAX_ENGINES][DIMMER_COUNT];
+
+// count of engines, engines after the first are pinned to distinct CPUs by default
+static unsigned int ac_dimmer_engines = 1;
+
+// shift register chain pins, and count of its outputs (0 for none)
+static int ac_dimmer_sr_data = -1;
+static int ac_dimmer_sr_clock = -1;
+static int ac_dimmer_sr_latch = -1;
+static unsigned int ac_dimmer_sr_bits = 0;
+
+// dimmers claimed at init, list such as "4,5,17-22"
+static char *ac_dimmer_gpios = NULL;
+
+// timer events closer than that are fired together
+static unsigned int ac_dimmer_batch_ns = 20000;
+
+// gate pulse ends may be that late, to be fired along with a later toggle
+static unsigned int ac_dimmer_gate_slack_ns = 50000;
+
+// firing grid, slots per half period (see struct dimmer_zc)
+static unsigned int ac_dimmer_slots = 200;
+
+static const char *const dimmer_curve_names[DIMMER_CURVE_COUNT] =
+{
+	"linear",
+	"power",
 };
 
+static const char *const dimmer_mode_names[DIMMER_MODE_COUNT] =
+{
+	"leading",
+	"trailing",
+	"burst",
+};
+
+static const char *const dimmer_binding_names[DIMMER_BINDING_COUNT] =
+{
+	"none",
+	"toggle",
+	"step",
+	"fade",
+};
+
+// default binding arg, in percent
+static const int dimmer_binding_args[DIMMER_BINDING_COUNT] = { 0, 0, 25, 2 };
+
+static struct dimmer_zc dimmer_zcs[AC_ZC_MAX_DETECTORS];
+static unsigned int dimmer_zc_count = 0;
+
 /* dimmer_table
  *
  * The table will hold a description for any GPIO pin available
  * on the system. It's wasteful to preallocate the entire table,
  * but avoiding race conditions is so much easier this way ;-)
+ * Shift register outputs follow GPIO pins, see DIMMER_SR_INDEX.
 */
-static struct dimmer_desc dimmer_table[ARCH_NR_GPIOS];
+static struct dimmer_desc dimmer_table[DIMMER_COUNT];
+
+/* channels
+ *
+ * Exported dimmers are also kept in a compact list so that crossings
+ * only walk actual channels, it is protected by schedule_lock.
+ * Pending toggles are kept in the run queue of the channel engine,
+ * protected by the engine lock, taken after schedule_lock.
+ */
+static struct dimmer_desc *channels[DIMMER_COUNT];
+static unsigned int channel_count = 0;
+static DEFINE_RAW_SPINLOCK(schedule_lock);
+
+// shortest gate pulse or gap between pulses of a train (ns), bounds batching
+static u32 pulse_min = DIMMER_GATE_PULSE;
+
+// status page, mapped by /dev/ac_dimmer_status readers, updated under schedule_lock
+static struct ac_dimmer_status *status_page = NULL;
+
+// debugfs root, one directory per exported dimmer
+static struct dentry *ac_dimmer_debugfs = NULL;
 
 /* lock protects against dimmer_unexport() being called while
  * sysfs files are active.
  */
 static DEFINE_MUTEX(sysfs_lock);
 
+static int ac_dimmer_genl_get(struct sk_buff *skb, struct genl_info *info);
+static void ac_dimmer_genl_event(struct dimmer_desc *desc, ktime_t time, gfp_t flags);
+
+static int dimmer_claim(unsigned int gpio);
+static int dimmer_release(unsigned int gpio);
 static int dimmer_export(unsigned int gpio);
 static int dimmer_unexport(unsigned int gpio);
 static ssize_t dimmer_show(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t dimmer_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t size);
 static ssize_t export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
 static ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t cpu_show(struct class *class, struct class_attribute *attr, char *buf);
+static ssize_t cpu_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t effective_cpu_show(struct class *class, struct class_attribute *attr, char *buf);
+static ssize_t sr_export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t sr_unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static int sr_claim(unsigned int bit);
+static int sr_release(unsigned int bit);
+static struct dimmer_desc *dimmer_lookup(u32 gpio);
+
+static void channel_add(struct dimmer_desc *desc);
+static void channel_remove(struct dimmer_desc *desc);
+static void channel_set_zc(struct dimmer_desc *desc, unsigned int zc);
+static void channel_set_value(struct dimmer_desc *desc, int value, int curve);
+static void channel_set_engine(struct dimmer_desc *desc, unsigned int engine);
+static void channel_set_mode(struct dimmer_desc *desc, int mode);
+static int channel_set_pulse(struct dimmer_desc *desc, u32 width, unsigned int count, u32 period);
+static void pulse_min_update(void);
+static void channel_get_energy(const struct dimmer_desc *desc, u64 *energy, u64 *half_cycles);
+static void channel_reset_energy(struct dimmer_desc *desc);
+static void status_update(void);
+static int dimmer_bind(struct dimmer_desc *desc, const char *buf);
+static void dimmer_unbind(struct dimmer_desc *desc);
+static void ac_dimmer_button_handler(int status, void *data);
+static void dimmer_notify(struct work_struct *work);
+static void dimmer_notify_queue(struct irq_work *work);
+
+// userspace notifications of changes made from timers, queued from
+// an irq_work as queuing work takes sleeping locks on PREEMPT_RT
+static DECLARE_WORK(notify_work, dimmer_notify);
+static struct irq_work notify_irq_work;
+
+static void dimmer_debugfs_create(struct dimmer_desc *desc);
 
 static void ac_dimmer_zc_handler(int status, void *data);
 static enum hrtimer_restart ac_dimmer_hrtimer_callback(struct hrtimer *timer);
@@ -74,15 +204,83 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vincent TRUMPFF");
 MODULE_DESCRIPTION("Driver for AC dimmer");
 
+module_param(ac_dimmer_batch_ns, uint, 0644);
+MODULE_PARM_DESC(ac_dimmer_batch_ns, "Timer events closer than this are fired together (ns)");
+module_param(ac_dimmer_gate_slack_ns, uint, 0644);
+MODULE_PARM_DESC(ac_dimmer_gate_slack_ns, "Gate pulse ends may be this late to share a timer event (ns, 0 = exact)");
+module_param(ac_dimmer_slots, uint, 0444);
+MODULE_PARM_DESC(ac_dimmer_slots, "Firing times are rounded to this many slots per half period, bounding timer events (0 = exact)");
+module_param(ac_dimmer_engines, uint, 0444);
+MODULE_PARM_DESC(ac_dimmer_engines, "Count of firing timers channels are spread across, one per CPU");
+module_param(ac_dimmer_gpios, charp, 0444);
+MODULE_PARM_DESC(ac_dimmer_gpios, "Dimmer GPIO list exported at load, eg: 4,5,17-22");
+module_param(ac_dimmer_sr_data, int, 0444);
+MODULE_PARM_DESC(ac_dimmer_sr_data, "Shift register chain data GPIO");
+module_param(ac_dimmer_sr_clock, int, 0444);
+MODULE_PARM_DESC(ac_dimmer_sr_clock, "Shift register chain clock GPIO");
+module_param(ac_dimmer_sr_latch, int, 0444);
+MODULE_PARM_DESC(ac_dimmer_sr_latch, "Shift register chain latch GPIO");
+module_param(ac_dimmer_sr_bits, uint, 0444);
+MODULE_PARM_DESC(ac_dimmer_sr_bits, "Count of shift register chain outputs, 0 for no chain");
+
 module_init(ac_dimmer_init);
 module_exit(ac_dimmer_exit);
 
+/* Generic netlink family, see ac_user.h */
+static const struct nla_policy ac_dimmer_genl_policy[AC_ATTR_MAX + 1] =
+{
+	[AC_ATTR_GPIO] = { .type = NLA_U32 },
+};
+
+static const struct genl_ops ac_dimmer_genl_ops[] =
+{
+	{
+		.cmd    = AC_CMD_GET,
+		.doit   = ac_dimmer_genl_get,
+		.policy = ac_dimmer_genl_policy,
+	},
+};
+
+static const struct genl_multicast_group ac_dimmer_genl_groups[] =
+{
+	{ .name = AC_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family ac_dimmer_genl_family =
+{
+	.id      = GENL_ID_GENERATE,
+	.name    = AC_DIMMER_GENL_NAME,
+	.version = AC_GENL_VERSION,
+	.maxattr = AC_ATTR_MAX,
+	.module  = THIS_MODULE,
+};
+
 /* Sysfs attributes definition for dimmers */
 static DEVICE_ATTR(value,   0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(curve,   0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(mode,    0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(zc,      0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(binding, 0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(engine,  0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(pulse_us,        0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(pulse_count,     0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(pulse_period_us, 0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(energy,      0644, dimmer_show, dimmer_store);
+static DEVICE_ATTR(half_cycles, 0444, dimmer_show, NULL);
 
 static const struct attribute *ac_dimmer_dev_attrs[] =
 {
 	&dev_attr_value.attr,
+	&dev_attr_curve.attr,
+	&dev_attr_mode.attr,
+	&dev_attr_zc.attr,
+	&dev_attr_binding.attr,
+	&dev_attr_engine.attr,
+	&dev_attr_pulse_us.attr,
+	&dev_attr_pulse_count.attr,
+	&dev_attr_pulse_period_us.attr,
+	&dev_attr_energy.attr,
+	&dev_attr_half_cycles.attr,
 	NULL,
 };
 
@@ -96,6 +294,10 @@ static struct class_attribute ac_dimmer_class_attrs[] =
 {
 	__ATTR_WO(export),
 	__ATTR_WO(unexport),
+	__ATTR_RW(cpu),
+	__ATTR_RO(effective_cpu),
+	__ATTR_WO(sr_export),
+	__ATTR_WO(sr_unexport),
 	__ATTR_NULL,
 };
 static struct class ac_dimmer_class =
@@ -119,6 +321,34 @@ ssize_t dimmer_show(struct device *dev, struct device_attribute *attr, char *buf
 	{
 		if(strcmp(attr->attr.name, "value") == 0)
 			status = sprintf(buf, "%d\n", desc->value);
+		else if(strcmp(attr->attr.name, "curve") == 0)
+			status = sprintf(buf, "%s\n", dimmer_curve_names[desc->curve]);
+		else if(strcmp(attr->attr.name, "mode") == 0)
+			status = sprintf(buf, "%s\n", dimmer_mode_names[desc->mode]);
+		else if(strcmp(attr->attr.name, "zc") == 0)
+			status = sprintf(buf, "%u\n", desc->zc);
+		else if(strcmp(attr->attr.name, "engine") == 0)
+			status = sprintf(buf, "%u\n", desc->engine);
+		else if(strcmp(attr->attr.name, "pulse_us") == 0)
+			status = sprintf(buf, "%u\n", desc->pulse_width / 1000);
+		else if(strcmp(attr->attr.name, "pulse_count") == 0)
+			status = sprintf(buf, "%u\n", desc->pulse_count);
+		else if(strcmp(attr->attr.name, "pulse_period_us") == 0)
+			status = sprintf(buf, "%u\n", desc->pulse_period / 1000);
+		else if(strcmp(attr->attr.name, "energy") == 0 || strcmp(attr->attr.name, "half_cycles") == 0)
+		{
+			u64 energy;
+			u64 half_cycles;
+			channel_get_energy(desc, &energy, &half_cycles);
+			status = sprintf(buf, "%llu\n", attr == &dev_attr_energy ? energy : half_cycles);
+		}
+		else if(strcmp(attr->attr.name, "binding") == 0)
+		{
+			if(desc->binding.action == DIMMER_BINDING_NONE)
+				status = sprintf(buf, "%s\n", dimmer_binding_names[DIMMER_BINDING_NONE]);
+			else
+				status = sprintf(buf, "%u %s %d\n", desc->binding.gpio, dimmer_binding_names[desc->binding.action], desc->binding.arg);
+		}
 		else
 			status = -EIO;
 	}
@@ -135,6 +365,38 @@ ssize_t dimmer_store(struct device *dev, struct device_attribute *attr, const ch
 	if(!test_bit(FLAG_ACDIMMER, &desc->flags)){
 		status = -EIO;
 	}
+	else if(strcmp(attr->attr.name, "binding") == 0)
+	{
+		status = dimmer_bind(desc, buf);
+	}
+	else if(strcmp(attr->attr.name, "curve") == 0)
+	{
+		int curve;
+		status = -EINVAL;
+		for(curve = 0; curve < DIMMER_CURVE_COUNT; ++curve)
+		{
+			if(sysfs_streq(buf, dimmer_curve_names[curve]))
+			{
+				channel_set_value(desc, desc->value, curve);
+				status = 0;
+				break;
+			}
+		}
+	}
+	else if(strcmp(attr->attr.name, "mode") == 0)
+	{
+		int mode;
+		status = -EINVAL;
+		for(mode = 0; mode < DIMMER_MODE_COUNT; ++mode)
+		{
+			if(sysfs_streq(buf, dimmer_mode_names[mode]))
+			{
+				channel_set_mode(desc, mode);
+				status = 0;
+				break;
+			}
+		}
+	}
 	else
 	{
 		unsigned long value;
@@ -147,7 +409,51 @@ ssize_t dimmer_store(struct device *dev, struct device_attribute *attr, const ch
 					value = 0;
 				if(value > 100)
 					value = 100;
-				desc->value = value;
+				channel_set_value(desc, value, desc->curve);
+				ac_dimmer_genl_event(desc, ktime_get(), GFP_KERNEL);
+			}
+			else if(strcmp(attr->attr.name, "zc") == 0)
+			{
+				if(value < dimmer_zc_count)
+					channel_set_zc(desc, value);
+				else
+					status = -EINVAL;
+			}
+			else if(strcmp(attr->attr.name, "engine") == 0)
+			{
+				if(value < ac_dimmer_engines)
+					channel_set_engine(desc, value);
+				else
+					status = -EINVAL;
+			}
+			else if(strcmp(attr->attr.name, "energy") == 0)
+			{
+				// only reset
+				if(value == 0)
+					channel_reset_energy(desc);
+				else
+					status = -EINVAL;
+			}
+			else if(strcmp(attr->attr.name, "pulse_us") == 0)
+			{
+				if(value <= DIMMER_PULSE_MAX / 1000)
+					status = channel_set_pulse(desc, value * 1000, desc->pulse_count, desc->pulse_period);
+				else
+					status = -EINVAL;
+			}
+			else if(strcmp(attr->attr.name, "pulse_count") == 0)
+			{
+				if(value <= DIMMER_PULSE_COUNT)
+					status = channel_set_pulse(desc, desc->pulse_width, value, desc->pulse_period);
+				else
+					status = -EINVAL;
+			}
+			else if(strcmp(attr->attr.name, "pulse_period_us") == 0)
+			{
+				if(value <= DIMMER_PULSE_MAX / 1000)
+					status = channel_set_pulse(desc, desc->pulse_width, desc->pulse_count, value * 1000);
+				else
+					status = -EINVAL;
 			}
 		}
 	}
@@ -155,71 +461,333 @@ ssize_t dimmer_store(struct device *dev, struct device_attribute *attr, const ch
 	return status ? : size;
 }
 
-/* Export a GPIO pin to sysfs, and claim it for dimmer usage.
+/* Answer AC_CMD_GET with the current value of a dimmer */
+int ac_dimmer_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+	struct dimmer_desc *desc;
+	struct sk_buff *msg;
+	u32 gpio;
+
+	if(!info->attrs[AC_ATTR_GPIO])
+		return -EINVAL;
+
+	gpio = nla_get_u32(info->attrs[AC_ATTR_GPIO]);
+	desc = dimmer_lookup(gpio);
+	if(!desc)
+		return -EINVAL;
+
+	if(!test_bit(FLAG_ACDIMMER, &desc->flags))
+		return -ENODEV;
+
+	msg = ac_genl_event(&ac_dimmer_genl_family, info->snd_portid, info->snd_seq, gpio, desc->value, ktime_get(), GFP_KERNEL);
+	if(!msg)
+		return -ENOMEM;
+
+	return genlmsg_reply(msg, info);
+}
+
+/* Multicast a dimmer change, nobody listening is not an error */
+void ac_dimmer_genl_event(struct dimmer_desc *desc, ktime_t time, gfp_t flags)
+{
+	struct sk_buff *msg;
+
+	msg = ac_genl_event(&ac_dimmer_genl_family, 0, 0, desc->gpio, desc->value, time, flags);
+	if(msg)
+		genlmsg_multicast(&ac_dimmer_genl_family, msg, 0, 0, flags);
+}
+
+/* Export GPIO pins to sysfs, and claim them for dimmer usage.
+ * Takes a list such as "4,5,17-22", either all pins are claimed or none.
  * See the equivalent function in drivers/gpio/gpiolib.c
  */
 ssize_t export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
 {
-	long gpio;
+	DECLARE_BITMAP(gpios, ARCH_NR_GPIOS);
+	unsigned int gpio;
+	unsigned int done;
 	int status;
 
-	status = kstrtol(buf, 0, &gpio);
+	status = ac_parse_gpio_list(buf, gpios);
 	if(status < 0)
-		goto done;
+		goto fail_safe;
 
-	status = gpio_request(gpio, "ac_dimmer");
-	if(status < 0)
-		goto done;
+	for_each_set_bit(gpio, gpios, ARCH_NR_GPIOS)
+	{
+		status = dimmer_claim(gpio);
+		if(status < 0)
+			goto fail_after_claim;
+	}
 
-	status = gpio_direction_output(gpio,0);
-	if(status < 0)
-		goto done;
+	return len;
 
-	status = dimmer_export(gpio);
+fail_after_claim:
+	for_each_set_bit(done, gpios, gpio)
+		dimmer_release(done);
+fail_safe:
+	pr_debug("%s: status %d\n", __func__, status);
+	return status;
+}
+
+/* Unexport dimmer GPIO pins from sysfs, and unreclaim them.
+ * Takes a list such as "4,5,17-22", pins not exported are reported
+ * as an error once the others are released.
+ * See the equivalent function in drivers/gpio/gpiolib.c
+ */
+ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	DECLARE_BITMAP(gpios, ARCH_NR_GPIOS);
+	unsigned int gpio;
+	int status;
+	int ret = 0;
+
+	status = ac_parse_gpio_list(buf, gpios);
 	if(status < 0)
 		goto done;
 
-	set_bit(FLAG_ACDIMMER, &dimmer_table[gpio].flags);
+	for_each_set_bit(gpio, gpios, ARCH_NR_GPIOS)
+	{
+		ret = dimmer_release(gpio);
+		if(ret < 0)
+			status = ret;
+	}
 
 done:
 	if(status)
-	{
-		gpio_free(gpio);
 		pr_debug("%s: status %d\n", __func__, status);
-	}
 	return status ? : len;
 }
 
-/* Unexport a dimmer GPIO pin from sysfs, and unreclaim it.
- * See the equivalent function in drivers/gpio/gpiolib.c
+/* Export shift register outputs to sysfs as dimmer_sr<n>, and claim them.
+ * Takes a list such as "0-15", either all outputs are claimed or none.
  */
-ssize_t unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+ssize_t sr_export_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
 {
-	long gpio;
-	int  status;
+	DECLARE_BITMAP(bits, ARCH_NR_GPIOS);
+	unsigned int bit;
+	unsigned int done;
+	int status;
 
-	status = kstrtol(buf, 0, &gpio);
+	status = ac_parse_gpio_list(buf, bits);
 	if(status < 0)
-		goto done;
+		goto fail_safe;
 
-	status = -EINVAL;
-	if(!gpio_is_valid(gpio))
+	for_each_set_bit(bit, bits, ARCH_NR_GPIOS)
+	{
+		status = sr_claim(bit);
+		if(status < 0)
+			goto fail_after_claim;
+	}
+
+	return len;
+
+fail_after_claim:
+	for_each_set_bit(done, bits, bit)
+		sr_release(done);
+fail_safe:
+	pr_debug("%s: status %d\n", __func__, status);
+	return status;
+}
+
+/* Unexport shift register outputs from sysfs, and unreclaim them.
+ * Takes a list such as "0-15", outputs not exported are reported
+ * as an error once the others are released.
+ */
+ssize_t sr_unexport_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	DECLARE_BITMAP(bits, ARCH_NR_GPIOS);
+	unsigned int bit;
+	int status;
+	int ret = 0;
+
+	status = ac_parse_gpio_list(buf, bits);
+	if(status < 0)
 		goto done;
 
-	if(test_and_clear_bit(FLAG_ACDIMMER, &dimmer_table[gpio].flags))
+	for_each_set_bit(bit, bits, ARCH_NR_GPIOS)
 	{
-		status = dimmer_unexport(gpio);
-		if(status == 0)
-			gpio_free(gpio);
+		ret = sr_release(bit);
+		if(ret < 0)
+			status = ret;
 	}
+
 done:
 	if(status)
 		pr_debug("%s: status %d\n", __func__, status);
 	return status ? : len;
 }
 
-/* Setup the sysfs directory for a claimed dimmer device */
-int dimmer_export(unsigned int gpio)
+/* Show the CPU each engine timer is pinned to, -1 for any */
+ssize_t cpu_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	unsigned int index;
+	ssize_t len = 0;
+
+	for(index = 0; index < ac_dimmer_engines; ++index)
+		len += sprintf(buf + len, "%s%d", index ? " " : "", engines[index].cpu);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+/* Pin engine timers to CPUs, from their next arming.
+ * Takes one CPU per engine, separated by spaces, engines
+ * not listed are left unchanged.
+ */
+ssize_t cpu_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	char *list;
+	char *cursor;
+	char *token;
+	unsigned int index = 0;
+	int cpus[DIMMER_MAX_ENGINES];
+	int status = 0;
+
+	list = cursor = kstrndup(buf, len, GFP_KERNEL);
+	if(!list)
+		return -ENOMEM;
+
+	while((token = strsep(&cursor, " \n")))
+	{
+		if(!*token)
+			continue;
+		status = -EINVAL;
+		if(index >= ac_dimmer_engines)
+			break;
+		status = ac_parse_cpu(token, &cpus[index++]);
+		if(status < 0)
+			break;
+	}
+
+	kfree(list);
+	if(status < 0)
+		return status;
+
+	while(index-- > 0)
+		engines[index].cpu = cpus[index];
+	return len;
+}
+
+/* Show the CPU of the last run of each engine timer */
+ssize_t effective_cpu_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	unsigned int index;
+	ssize_t len = 0;
+
+	for(index = 0; index < ac_dimmer_engines; ++index)
+		len += sprintf(buf + len, "%s%d", index ? " " : "", engines[index].last_cpu);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+/* Claim a GPIO pin for dimmer usage and start firing it */
+int dimmer_claim(unsigned int gpio)
+{
+	int status;
+
+	status = gpio_request(gpio, "ac_dimmer");
+	if(status < 0)
+		goto fail_safe;
+
+	dimmer_table[gpio].gpiod = gpio_to_desc(gpio);
+
+	status = gpiod_direction_output_raw(dimmer_table[gpio].gpiod, 0);
+	if(status < 0)
+		goto fail_after_gpio;
+
+	dimmer_table[gpio].gpio = gpio;
+
+	status = dimmer_export(gpio);
+	if(status < 0)
+		goto fail_after_gpio;
+
+	set_bit(FLAG_ACDIMMER, &dimmer_table[gpio].flags);
+	channel_add(&dimmer_table[gpio]);
+	return 0;
+
+fail_after_gpio:
+	gpio_free(gpio);
+fail_safe:
+	pr_debug("%s: dimmer%u status %d\n", __func__, gpio, status);
+	return status;
+}
+
+/* Stop firing a dimmer, switch it off and unreclaim its GPIO pin */
+int dimmer_release(unsigned int gpio)
+{
+	int status;
+
+	if(!test_and_clear_bit(FLAG_ACDIMMER, &dimmer_table[gpio].flags))
+		return -EINVAL;
+
+	channel_remove(&dimmer_table[gpio]);
+	gpiod_set_raw_value(dimmer_table[gpio].gpiod, 0);
+	status = dimmer_unexport(gpio);
+	if(status == 0)
+		gpio_free(gpio);
+	return status;
+}
+
+/* Claim a shift register output for dimmer usage and start firing it */
+int sr_claim(unsigned int bit)
+{
+	unsigned int index = DIMMER_SR_INDEX(bit);
+	int status;
+
+	if(bit >= ac_dimmer_sr_bits)
+		return -EINVAL;
+	if(test_bit(FLAG_ACDIMMER, &dimmer_table[index].flags))
+		return -EBUSY;
+
+	dimmer_table[index].gpiod = NULL;
+	dimmer_table[index].gpio = AC_DIMMER_SR + bit;
+
+	status = dimmer_export(index);
+	if(status < 0)
+		return status;
+
+	set_bit(FLAG_ACDIMMER, &dimmer_table[index].flags);
+	channel_add(&dimmer_table[index]);
+	return 0;
+}
+
+/* Stop firing a shift register output and switch it off */
+int sr_release(unsigned int bit)
+{
+	unsigned int index = DIMMER_SR_INDEX(bit);
+
+	if(bit >= ac_dimmer_sr_bits || !test_and_clear_bit(FLAG_ACDIMMER, &dimmer_table[index].flags))
+		return -EINVAL;
+
+	channel_remove(&dimmer_table[index]);
+	dimmer_sr_set(bit, 0);
+	dimmer_sr_flush();
+	return dimmer_unexport(index);
+}
+
+/* Find an exportable dimmer from its userspace id : GPIO or AC_DIMMER_SR + output */
+struct dimmer_desc *dimmer_lookup(u32 gpio)
+{
+	if(gpio >= AC_DIMMER_SR && gpio - AC_DIMMER_SR < ac_dimmer_sr_bits)
+		return &dimmer_table[DIMMER_SR_INDEX(gpio - AC_DIMMER_SR)];
+	if(gpio < ARCH_NR_GPIOS)
+		return &dimmer_table[gpio];
+	return NULL;
+}
+
+/* Drive the gate of a dimmer, on its GPIO or in the shift register
+ * chain, which is pushed by the caller with dimmer_sr_flush().
+ */
+static inline void dimmer_output(struct dimmer_desc *desc, int level)
+{
+	if(desc->gpiod)
+		gpiod_set_raw_value(desc->gpiod, level);
+	else
+		dimmer_sr_set(DIMMER_SR_BIT(desc - dimmer_table), level);
+}
+
+/* Setup the sysfs directory for a claimed dimmer device,
+ * index is its dimmer_table entry.
+ */
+int dimmer_export(unsigned int index)
 {
 	struct dimmer_desc *desc;
 	struct device   *dev;
@@ -227,15 +795,39 @@ int dimmer_export(unsigned int gpio)
 
 	mutex_lock(&sysfs_lock);
 
-	desc = &dimmer_table[gpio];
+	desc = &dimmer_table[index];
 	desc->value = 0;
+	desc->curve = DIMMER_CURVE_LINEAR;
+	desc->mode = DIMMER_MODE_LEADING;
+	desc->burst_error = 0;
+	desc->burst_half = 0;
+	desc->pulse_width = DIMMER_GATE_PULSE;
+	desc->pulse_count = 1;
+	desc->pulse_period = 2 * DIMMER_GATE_PULSE;
+	desc->pulse_left = 0;
+	desc->cutoff = 0;
+	desc->energy = 0;
+	desc->half_cycles = 0;
+	desc->zc = 0;
 	desc->gpio_value = 0;
-	dev = device_create(&ac_dimmer_class, NULL, MKDEV(0, 0), desc, "dimmer%d", gpio);
+	desc->binding.action = DIMMER_BINDING_NONE;
+	desc->binding.id = 0;
+	desc->binding.last_value = 0;
+	desc->binding.fade_dir = -1;
+	dimmer_jitter_reset(&desc->jitter);
+	if(index < ARCH_NR_GPIOS)
+		dev = device_create(&ac_dimmer_class, NULL, MKDEV(0, 0), desc, "dimmer%u", index);
+	else
+		dev = device_create(&ac_dimmer_class, NULL, MKDEV(0, 0), desc, "dimmer_sr%u", DIMMER_SR_BIT(index));
+	desc->dev = dev;
 	if(dev)
 	{
 		status = sysfs_create_group(&dev->kobj, &ac_dimmer_dev_attr_group);
 		if(status == 0)
-			printk(KERN_INFO "Registered device dimmer%d\n", gpio);
+		{
+			dimmer_debugfs_create(desc);
+			printk(KERN_INFO "Registered device %s\n", dev_name(dev));
+		}
 		else
 			device_unregister(dev);
 	}
@@ -247,7 +839,7 @@ int dimmer_export(unsigned int gpio)
 	mutex_unlock(&sysfs_lock);
 
 	if(status)
-		pr_debug("%s: dimmer%d status %d\n", __func__, gpio, status);
+		pr_debug("%s: dimmer %u status %d\n", __func__, index, status);
 	return status;
 }
 
@@ -257,8 +849,10 @@ static int match_export(struct device *dev, const void *data)
 	return dev_get_drvdata(dev) == data;
 }
 
-/* Free a claimed dimmer device and unregister the sysfs directory */
-int dimmer_unexport(unsigned int gpio)
+/* Free a claimed dimmer device and unregister the sysfs directory,
+ * index is its dimmer_table entry.
+ */
+int dimmer_unexport(unsigned int index)
 {
 	struct dimmer_desc *desc;
 	struct device   *dev;
@@ -266,13 +860,16 @@ int dimmer_unexport(unsigned int gpio)
 
 	mutex_lock(&sysfs_lock);
 
-	desc = &dimmer_table[gpio];
+	desc = &dimmer_table[index];
 	dev  = class_find_device(&ac_dimmer_class, NULL, desc, match_export);
 	if(dev)
 	{
+		dimmer_unbind(desc);
+		debugfs_remove_recursive(desc->debugfs);
+		desc->debugfs = NULL;
+		printk(KERN_INFO "Unregistered device %s\n", dev_name(dev));
 		put_device(dev);
 		device_unregister(dev);
-		printk(KERN_INFO "Unregistered device dimmer%d\n", gpio);
 		status = 0;
 	}
 	else
@@ -283,157 +880,727 @@ int dimmer_unexport(unsigned int gpio)
 	mutex_unlock(&sysfs_lock);
 
 	if(status)
-		pr_debug("%s: dimmer%d status %d\n", __func__, gpio, status);
+		pr_debug("%s: dimmer %u status %d\n", __func__, index, status);
 	return status;
 }
 
-/* The timer callback is called only when needed (which is to
- * say, at the earliest dimmer signal toggling time) in order to
- * maintain the pressure on system latency as low as possible
+/* Bind a dimmer to a button, from "<gpio> <action> [arg]" or "none".
+ * sysfs_lock must be held.
  */
-enum hrtimer_restart ac_dimmer_hrtimer_callback(struct hrtimer *timer)
+int dimmer_bind(struct dimmer_desc *desc, const char *buf)
 {
+	struct dimmer_binding *binding = &desc->binding;
+	char name[16];
 	unsigned int gpio;
+	int arg;
+	int action;
+	int count;
+	int status;
+	typeof(&ac_button_register) button_register;
+
+	if(sysfs_streq(buf, dimmer_binding_names[DIMMER_BINDING_NONE]))
+	{
+		dimmer_unbind(desc);
+		return 0;
+	}
+
+	count = sscanf(buf, "%u %15s %d", &gpio, name, &arg);
+	if(count < 2 || gpio >= ARCH_NR_GPIOS)
+		return -EINVAL;
+
+	for(action = DIMMER_BINDING_NONE + 1; action < DIMMER_BINDING_COUNT; ++action)
+	{
+		if(strcmp(name, dimmer_binding_names[action]) == 0)
+			break;
+	}
+	if(action == DIMMER_BINDING_COUNT)
+		return -EINVAL;
+
+	if(count < 3)
+		arg = dimmer_binding_args[action];
+	if(arg < 0 || arg > 100)
+		return -EINVAL;
+
+	dimmer_unbind(desc);
+
+	binding->action = action;
+	binding->gpio = gpio;
+	binding->arg = arg;
+	binding->fade_held = 0;
+
+	// ac_button is optional, a binding holds it loaded until unbound
+	status = -ENODEV;
+	button_register = symbol_get(ac_button_register);
+	if(button_register)
+		status = button_register(gpio, AC_BUTTON_STATUS_PRESS | AC_BUTTON_STATUS_RELEASE | AC_BUTTON_STATUS_HOLD, ac_dimmer_button_handler, desc);
+	if(status < 0)
+	{
+		if(button_register)
+			symbol_put(ac_button_register);
+		binding->action = DIMMER_BINDING_NONE;
+		return status;
+	}
+
+	binding->id = status;
+	return 0;
+}
+
+/* Remove the button binding of a dimmer, sysfs_lock must be held */
+void dimmer_unbind(struct dimmer_desc *desc)
+{
+	struct dimmer_binding *binding = &desc->binding;
+	typeof(&ac_button_unregister) button_unregister;
+
+	if(binding->id > 0)
+	{
+		// cannot fail, the binding holds ac_button loaded
+		button_unregister = symbol_get(ac_button_unregister);
+		button_unregister(binding->id);
+		symbol_put(ac_button_unregister);
+		symbol_put(ac_button_register);
+	}
+	binding->id = 0;
+	binding->action = DIMMER_BINDING_NONE;
+}
+
+/* Called from the ac_button sampling timer on events of the bound button,
+ * the dimmer follows without userspace, which is notified afterwards.
+ */
+void ac_dimmer_button_handler(int status, void *data)
+{
+	struct dimmer_desc *desc = data;
+	int value;
+
+	value = dimmer_binding_action(&desc->binding, status, desc->value);
+	if(value == desc->value)
+		return;
+
+	channel_set_value(desc, value, desc->curve);
+	desc->changed = ktime_get();
+	set_bit(FLAG_NOTIFY, &desc->flags);
+	irq_work_queue(&notify_irq_work);
+}
+
+void dimmer_notify_queue(struct irq_work *work)
+{
+	schedule_work(&notify_work);
+}
+
+/* Notify userspace of values changed by bindings */
+void dimmer_notify(struct work_struct *work)
+{
+	unsigned int index;
 	struct dimmer_desc *desc;
-	ktime_t now = ktime_get();
-	ktime_t next_tick = ktime_set(0,0);
 
-	for(gpio=0; gpio<ARCH_NR_GPIOS; gpio++)
+	mutex_lock(&sysfs_lock);
+	for(index = 0; index < DIMMER_COUNT; ++index)
 	{
-		desc = &dimmer_table[gpio];
+		desc = &dimmer_table[index];
+		if(!test_and_clear_bit(FLAG_NOTIFY, &desc->flags))
+			continue;
 		if(!test_bit(FLAG_ACDIMMER, &desc->flags))
 			continue;
 
-		if(desc->next_tick.tv64 == 0)
-			continue;
+		sysfs_notify(&desc->dev->kobj, NULL, "value");
+		ac_dimmer_genl_event(desc, desc->changed, GFP_KERNEL);
+	}
+	mutex_unlock(&sysfs_lock);
+}
 
-		// trigger
-		if(desc->next_tick.tv64 <= now.tv64)
+/* Show the firing jitter histograms of a dimmer */
+static int dimmer_jitter_show(struct seq_file *s, void *data)
+{
+	struct dimmer_desc *desc = s->private;
+	struct dimmer_jitter jitter;
+	unsigned long flags;
+	int level;
+	int bucket;
+
+	// recorded by the engine timer
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+	raw_spin_lock(&engines[desc->engine].lock);
+	jitter = desc->jitter;
+	raw_spin_unlock(&engines[desc->engine].lock);
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+
+	for(level = 1; level >= 0; --level)
+	{
+		seq_printf(s, "%s: count %u early %u min %d max %d\n", level ? "on" : "off",
+			jitter.count[level], jitter.early[level], jitter.min[level], jitter.max[level]);
+		for(bucket = 0; bucket < DIMMER_JITTER_BUCKETS; ++bucket)
 		{
-			if(desc->gpio_value == 0)
-			{
-				gpio_set_value(gpio, 1);
-				desc->gpio_value = 1;
-				desc->next_tick = ktime_add_ns(desc->next_tick, 300000);
-			}
+			if(bucket < DIMMER_JITTER_BUCKETS - 1)
+				seq_printf(s, "  < %6u us: %u\n", 1U << bucket, jitter.buckets[level][bucket]);
 			else
-			{
-				gpio_set_value(gpio, 0);
-				desc->gpio_value = 0;
-				// remove trigger
-				desc->next_tick = ktime_set(0,0);
-				continue;
-			}
+				seq_printf(s, " >= %6u us: %u\n", 1U << (bucket - 1), jitter.buckets[level][bucket]);
+		}
+	}
+	return 0;
+}
+
+static int dimmer_jitter_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dimmer_jitter_show, inode->i_private);
+}
+
+static const struct file_operations dimmer_jitter_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = dimmer_jitter_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/* Any write resets the firing jitter histograms of a dimmer */
+static ssize_t dimmer_reset_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	struct dimmer_desc *desc = file->private_data;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+	raw_spin_lock(&engines[desc->engine].lock);
+	dimmer_jitter_reset(&desc->jitter);
+	raw_spin_unlock(&engines[desc->engine].lock);
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+
+	return len;
+}
+
+static const struct file_operations dimmer_reset_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = simple_open,
+	.write   = dimmer_reset_write,
+	.llseek  = no_llseek,
+};
+
+/* Create debugfs entries of a dimmer, failures are not fatal */
+void dimmer_debugfs_create(struct dimmer_desc *desc)
+{
+	desc->debugfs = NULL;
+	if(IS_ERR_OR_NULL(ac_dimmer_debugfs))
+		return;
+
+	desc->debugfs = debugfs_create_dir(dev_name(desc->dev), ac_dimmer_debugfs);
+	if(IS_ERR_OR_NULL(desc->debugfs))
+		return;
+
+	debugfs_create_file("jitter", 0444, desc->debugfs, desc, &dimmer_jitter_fops);
+	debugfs_create_file("reset", 0200, desc->debugfs, desc, &dimmer_reset_fops);
+}
+
+/* Add an exported dimmer to the channels scanned at each crossing */
+void channel_add(struct dimmer_desc *desc)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+	desc->next_tick = ktime_set(0,0);
+	desc->engine = channel_count % ac_dimmer_engines;
+	channels[channel_count++] = desc;
+	pulse_min_update();
+	status_update();
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Remove a dimmer from the channels and from the pending toggles */
+void channel_remove(struct dimmer_desc *desc)
+{
+	unsigned long flags;
+	unsigned int index;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	for(index = 0; index < channel_count; ++index)
+	{
+		if(channels[index] != desc)
+			continue;
+		channels[index] = channels[--channel_count];
+		break;
+	}
+
+	raw_spin_lock(&engines[desc->engine].lock);
+	dimmer_run_queue_remove(&engines[desc->engine].run_queue, desc);
+	raw_spin_unlock(&engines[desc->engine].lock);
+	pulse_min_update();
+	status_update();
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Move a dimmer to another mains phase, it is fired again from its next crossing */
+void channel_set_zc(struct dimmer_desc *desc, unsigned int zc)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	raw_spin_lock(&engines[desc->engine].lock);
+	dimmer_run_queue_remove(&engines[desc->engine].run_queue, desc);
+	dimmer_output(desc, 0);
+	dimmer_sr_flush();
+	desc->gpio_value = 0;
+	raw_spin_unlock(&engines[desc->engine].lock);
+	desc->zc = zc;
+	status_update();
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Move a dimmer to another engine, it is fired again from its next crossing */
+void channel_set_engine(struct dimmer_desc *desc, unsigned int engine)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	raw_spin_lock(&engines[desc->engine].lock);
+	dimmer_run_queue_remove(&engines[desc->engine].run_queue, desc);
+	dimmer_output(desc, 0);
+	dimmer_sr_flush();
+	desc->gpio_value = 0;
+	raw_spin_unlock(&engines[desc->engine].lock);
+	desc->engine = engine;
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Change the value or curve of a dimmer, it applies from its next crossing */
+void channel_set_value(struct dimmer_desc *desc, int value, int curve)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	desc->value = value;
+	desc->curve = curve;
+	status_update();
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Change the firing mode of a dimmer, it is fired again from its next
+ * crossing : a toggle still pending would be handled by the new mode
+ * (eg a trailing edge cut off taken as a leading edge pulse train).
+ */
+void channel_set_mode(struct dimmer_desc *desc, int mode)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	raw_spin_lock(&engines[desc->engine].lock);
+	dimmer_run_queue_remove(&engines[desc->engine].run_queue, desc);
+	dimmer_output(desc, 0);
+	dimmer_sr_flush();
+	desc->gpio_value = 0;
+	desc->pulse_left = 0;
+	desc->mode = mode;
+	desc->burst_error = 0;
+	desc->burst_half = 0;
+	raw_spin_unlock(&engines[desc->engine].lock);
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Change the gate pulse train of a dimmer, pulses of a train
+ * must be apart, it applies from its next firing.
+ */
+int channel_set_pulse(struct dimmer_desc *desc, u32 width, unsigned int count, u32 period)
+{
+	unsigned long flags;
+
+	if(width < DIMMER_PULSE_MIN || count < 1)
+		return -EINVAL;
+	if(count > 1 && period < width + DIMMER_PULSE_MIN)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+
+	// read by the engine timer
+	raw_spin_lock(&engines[desc->engine].lock);
+	desc->pulse_width = width;
+	desc->pulse_count = count;
+	desc->pulse_period = period;
+	raw_spin_unlock(&engines[desc->engine].lock);
+	pulse_min_update();
+
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+	return 0;
+}
+
+/* Batching must not merge both edges of a pulse, or a pulse with the
+ * next one of its train, so it is kept below half of the shortest of
+ * them across channels. schedule_lock must be held.
+ */
+void pulse_min_update(void)
+{
+	struct dimmer_desc *desc;
+	unsigned int index;
+	u32 value = DIMMER_GATE_PULSE;
+
+	for(index = 0; index < channel_count; ++index)
+	{
+		desc = channels[index];
+		value = min(value, desc->pulse_width);
+		if(desc->pulse_count > 1)
+			value = min(value, desc->pulse_period - desc->pulse_width);
+	}
+
+	WRITE_ONCE(pulse_min, value);
+}
+
+/* Read energy counters of a dimmer, they are updated at its crossings */
+void channel_get_energy(const struct dimmer_desc *desc, u64 *energy, u64 *half_cycles)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+	*energy = desc->energy;
+	*half_cycles = desc->half_cycles;
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+void channel_reset_energy(struct dimmer_desc *desc)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&schedule_lock, flags);
+	desc->energy = 0;
+	desc->half_cycles = 0;
+	raw_spin_unlock_irqrestore(&schedule_lock, flags);
+}
+
+/* Publish channels to the status page, schedule_lock must be held */
+void status_update(void)
+{
+	struct ac_dimmer_status_channel *entry;
+	struct dimmer_desc *desc;
+	unsigned int index;
+	unsigned int count = min_t(unsigned int, channel_count, AC_STATUS_MAX_CHANNELS);
+
+	ac_status_write_begin(&status_page->seq);
+	for(index = 0; index < count; ++index)
+	{
+		desc = channels[index];
+		entry = &status_page->channels[index];
+		entry->gpio = desc->gpio;
+		entry->value = desc->value;
+		entry->curve = desc->curve;
+		entry->zc = desc->zc;
+	}
+	status_page->count = count;
+	ac_status_write_end(&status_page->seq);
+}
+
+static int status_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return ac_status_mmap(vma, status_page);
+}
+
+static const struct file_operations status_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = nonseekable_open,
+	.mmap    = status_mmap,
+	.llseek  = no_llseek,
+};
+
+static struct miscdevice status_device =
+{
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "ac_dimmer_status",
+	.fops  = &status_fops,
+};
+
+/* Program an engine timer on its earliest pending toggle, if any,
+ * or later when it is a gate pulse end that can ride a later toggle.
+ * The engine lock must be held.
+ */
+static void engine_arm(struct dimmer_engine *engine)
+{
+	ktime_t next_tick = dimmer_run_queue_expiry(&engine->run_queue, READ_ONCE(ac_dimmer_gate_slack_ns));
+	int cpu = engine->cpu;
+
+	if(next_tick.tv64 <= 0)
+		return;
+
+	if(cpu < 0)
+		hrtimer_start(&engine->timer, next_tick, HRTIMER_MODE_ABS);
+	else if(cpu == smp_processor_id())
+		hrtimer_start(&engine->timer, next_tick, HRTIMER_MODE_ABS_PINNED);
+	else if(!test_and_set_bit(FLAG_ARM_PENDING, &engine->flags))
+	{
+		if(smp_call_function_single_async(cpu, &engine->arm_csd) < 0)
+		{
+			// CPU went offline, fire from here rather than never
+			clear_bit(FLAG_ARM_PENDING, &engine->flags);
+			hrtimer_start(&engine->timer, next_tick, HRTIMER_MODE_ABS);
 		}
+	}
+}
 
-		// timer setup
-		if((next_tick.tv64 == 0) || (desc->next_tick.tv64 < next_tick.tv64))
-			next_tick.tv64 = desc->next_tick.tv64;
+/* Arm an engine timer from the CPU it is pinned to */
+static void engine_arm_remote(void *info)
+{
+	struct dimmer_engine *engine = info;
+	unsigned long flags;
+
+	clear_bit(FLAG_ARM_PENDING, &engine->flags);
+
+	raw_spin_lock_irqsave(&engine->lock, flags);
+	engine_arm(engine);
+	raw_spin_unlock_irqrestore(&engine->lock, flags);
+}
+
+/* The timer callback is called only when needed (which is to
+ * say, at the earliest dimmer signal toggling time) in order to
+ * maintain the pressure on system latency as low as possible.
+ * All toggles due within ac_dimmer_batch_ns are fired in the
+ * same run, the batch is kept below half a gate pulse so that
+ * a gate on and its gate off are never merged. Gate pulse ends
+ * are also delayed by up to ac_dimmer_gate_slack_ns to ride a
+ * later toggle (see engine_arm()).
+ * Toggles fall on the slots of the ac_dimmer_slots grid, each run
+ * fires at least one whole slot : an engine costs at most
+ * ac_dimmer_slots + 1 runs per phase and half period, however
+ * many channels it fires. Without a grid, spread values cost up
+ * to two runs per channel and half period.
+ */
+enum hrtimer_restart ac_dimmer_hrtimer_callback(struct hrtimer *timer)
+{
+	struct dimmer_engine *engine = container_of(timer, struct dimmer_engine, timer);
+	struct dimmer_desc *desc;
+	ktime_t limit;
+	ktime_t target;
+	int level;
+
+	raw_spin_lock(&engine->lock);
+
+	engine->last_cpu = smp_processor_id();
+	limit = ktime_add_ns(ktime_get(), min_t(unsigned int, ac_dimmer_batch_ns, READ_ONCE(pulse_min) / 2));
+
+	while((desc = dimmer_run_queue_pop(&engine->run_queue, limit)))
+	{
+		target = desc->next_tick;
+		level = dimmer_sched_toggle(desc);
+		dimmer_output(desc, level);
+		dimmer_jitter_record(&desc->jitter, level, ktime_to_ns(ktime_sub(ktime_get(), target)));
+		if(desc->next_tick.tv64)
+			dimmer_run_queue_insert(&engine->run_queue, desc);
 	}
 
-	if(next_tick.tv64 > 0)
-		hrtimer_start(&hr_timer, next_tick, HRTIMER_MODE_ABS);
+	// the whole batch in one transfer
+	dimmer_sr_flush();
+	engine_arm(engine);
+
+	raw_spin_unlock(&engine->lock);
 
 	return HRTIMER_NORESTART;
 }
 
+/* Called on each mains crossing of a phase, both polarities: every
+ * channel of that phase is fired once per half period, relative to the
+ * phase corrected crossing time rather than to the detector edge.
+ */
 void ac_dimmer_zc_handler(int status, void *data)
 {
-	unsigned int gpio;
+	struct dimmer_zc *zcd = data;
+	struct dimmer_engine *engine;
+	unsigned int index;
 	struct dimmer_desc *desc;
-	int period_cent = 0;
-	int freq = ac_zc_freq();
+	int level;
+	u32 period = ac_zc_period(zcd->zc) >> 1;
+	ktime_t crossing = ac_zc_crossing(zcd->zc);
 	ktime_t now = ktime_get();
-	ktime_t next_tick = ktime_set(0,0);
 
-	if(freq > 0)
-		period_cent = (NSEC_PER_SEC / 100) / freq;
+	dimmer_delay_table_update(zcd, period);
 
-	// timer management
-	for(gpio=0; gpio<ARCH_NR_GPIOS; gpio++)
+	raw_spin_lock(&schedule_lock);
+
+	// each engine is fed in turn, so that its timer can already run
+	for(engine = engines; engine < engines + ac_dimmer_engines; ++engine)
 	{
-		desc = &dimmer_table[gpio];
-		if(!test_bit(FLAG_ACDIMMER, &desc->flags))
-			continue;
+		raw_spin_lock(&engine->lock);
 
-		// reset timer
-		desc->next_tick = ktime_set(0,0);
+		// drop pending toggles of this phase, other phases keep theirs
+		dimmer_run_queue_drop_zc(&engine->run_queue, zcd->zc);
 
-		// full time on
-		if(desc->value == 100)
+		for(index = 0; index < channel_count; ++index)
 		{
-			gpio_set_value(gpio, 1);
-			continue;
+			desc = channels[index];
+			if(desc->zc != zcd->zc || desc->engine != engine->index)
+				continue;
+
+			level = dimmer_sched_crossing(desc, zcd, period, crossing, now);
+			dimmer_output(desc, level);
+			dimmer_sched_account(desc, level);
+			if(desc->next_tick.tv64)
+				dimmer_run_queue_insert(&engine->run_queue, desc);
 		}
 
-		// period start low
-		gpio_set_value(gpio, 0);
-		desc->gpio_value = 0;
+		dimmer_sr_flush();
+		engine_arm(engine);
 
-		// full time off or no period
-		if(desc->value == 0 || period_cent == 0)
-			continue;
+		raw_spin_unlock(&engine->lock);
+	}
 
-		// timer setup
-		// max 90 else it overlaps (timer delay ?)
-		desc->next_tick = ktime_add_ns(now, min(90, (100 - desc->value)) * period_cent);
-		if((next_tick.tv64 == 0) || (desc->next_tick.tv64 < next_tick.tv64))
-			next_tick.tv64 = desc->next_tick.tv64;
+	raw_spin_unlock(&schedule_lock);
+}
+
+/* Setup engines, when there are several they are pinned
+ * to distinct online CPUs, round robin.
+ */
+static void engines_init(void)
+{
+	struct dimmer_engine *engine;
+	unsigned int index;
+	int cpu = -1;
+
+	if(ac_dimmer_engines < 1)
+		ac_dimmer_engines = 1;
+	if(ac_dimmer_engines > DIMMER_MAX_ENGINES)
+		ac_dimmer_engines = DIMMER_MAX_ENGINES;
+
+	for(index = 0; index < ac_dimmer_engines; ++index)
+	{
+		engine = &engines[index];
+		engine->index = index;
+		ac_hrtimer_init(&engine->timer, HRTIMER_MODE_ABS);
+		engine->timer.function = &ac_dimmer_hrtimer_callback;
+		raw_spin_lock_init(&engine->lock);
+		engine->run_queue.items = run_queue_items[index];
+		engine->run_queue.count = 0;
+		engine->arm_csd.func = engine_arm_remote;
+		engine->arm_csd.info = engine;
+		engine->flags = 0;
+		engine->last_cpu = -1;
+
+		if(ac_dimmer_engines > 1)
+		{
+			cpu = cpumask_next(cpu, cpu_online_mask);
+			if(cpu >= nr_cpu_ids)
+				cpu = cpumask_first(cpu_online_mask);
+		}
+		engine->cpu = cpu;
 	}
+}
 
-	if(next_tick.tv64 > 0)
-		hrtimer_start(&hr_timer, next_tick, HRTIMER_MODE_ABS);
+/* Stop engines, the crossing handler must not run anymore */
+static void engines_exit(void)
+{
+	struct dimmer_engine *engine;
+
+	for(engine = engines; engine < engines + ac_dimmer_engines; ++engine)
+	{
+		// no more remote arming once the pending one has run
+		engine->cpu = -1;
+		while(test_bit(FLAG_ARM_PENDING, &engine->flags))
+			cpu_relax();
+		hrtimer_cancel(&engine->timer);
+	}
 }
 
 int __init ac_dimmer_init(void)
 {
 	int status;
+	unsigned int zc;
+	struct dimmer_zc *zcd;
 	printk(KERN_INFO "AC dimmer v0.1 initializing.\n");
 
-	hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	hr_timer.function = &ac_dimmer_hrtimer_callback;
+	engines_init();
+	init_irq_work(&notify_irq_work, dimmer_notify_queue);
+
+	BUILD_BUG_ON(sizeof(struct ac_dimmer_status) > PAGE_SIZE);
+	status_page = (struct ac_dimmer_status *)get_zeroed_page(GFP_KERNEL);
+	if(!status_page)
+		return -ENOMEM;
 
 	status = class_register(&ac_dimmer_class);
 	if(status < 0)
 		goto fail_no_class;
 
-	status = ac_zc_register(AC_ZC_STATUS_ENTER, ac_dimmer_zc_handler, NULL);
+	// debugfs is optional
+	ac_dimmer_debugfs = debugfs_create_dir("ac_dimmer", NULL);
+
+	for(zc = 0; zc < ac_zc_count(); ++zc)
+	{
+		zcd = &dimmer_zcs[zc];
+		zcd->zc = zc;
+		zcd->delay_table_period = 0;
+		zcd->slots = ac_dimmer_slots;
+
+		status = ac_zc_register(zc, AC_ZC_STATUS_CROSSING, ac_dimmer_zc_handler, zcd);
+		if(status < 0)
+			goto fail_zc_register;
+
+		zcd->id = status;
+		dimmer_zc_count = zc + 1;
+	}
+
+	status = misc_register(&status_device);
 	if(status < 0)
 		goto fail_zc_register;
 
-	ac_zc_id = status;
+	status = genl_register_family_with_ops_groups(&ac_dimmer_genl_family, ac_dimmer_genl_ops, ac_dimmer_genl_groups);
+	if(status < 0)
+		goto fail_after_status;
+
+	if(ac_dimmer_sr_bits > 0)
+	{
+		status = dimmer_sr_init(ac_dimmer_sr_data, ac_dimmer_sr_clock, ac_dimmer_sr_latch, ac_dimmer_sr_bits);
+		if(status < 0)
+			goto fail_after_genl;
+	}
+
+	// everything is ready, dimmers fire from now on
+	ac_provision(ac_dimmer_gpios, dimmer_claim, "ac_dimmer");
 
 	printk(KERN_INFO "AC dimmer initialized.\n");
 	return 0;
 
+fail_after_genl:
+	ac_dimmer_sr_bits = 0;
+	genl_unregister_family(&ac_dimmer_genl_family);
+fail_after_status:
+	misc_deregister(&status_device);
 fail_zc_register:
+	for(zc = 0; zc < dimmer_zc_count; ++zc)
+		ac_zc_unregister(zc, dimmer_zcs[zc].id);
+	dimmer_zc_count = 0;
+	debugfs_remove_recursive(ac_dimmer_debugfs);
 	class_unregister(&ac_dimmer_class);
 fail_no_class:
+	free_page((unsigned long)status_page);
 	return status;
 }
 
 void __exit ac_dimmer_exit(void)
 {
 	unsigned int gpio;
-	int status;
+	unsigned int zc;
 
-	ac_zc_unregister(ac_zc_id);
+	misc_deregister(&status_device);
 
-	hrtimer_cancel(&hr_timer);
+	for(zc = 0; zc < dimmer_zc_count; ++zc)
+		ac_zc_unregister(zc, dimmer_zcs[zc].id);
+
+	engines_exit();
 
 	for(gpio=0; gpio<ARCH_NR_GPIOS; gpio++)
-	{
-		struct dimmer_desc *desc;
-		desc = &dimmer_table[gpio];
-		if(test_bit(FLAG_ACDIMMER, &desc->flags))
-		{
-			gpio_set_value(gpio, 0);
-			status = dimmer_unexport(gpio);
-			if(status == 0)
-				gpio_free(gpio);
-		}
-	}
+		dimmer_release(gpio);
+	for(gpio=0; gpio<ac_dimmer_sr_bits; gpio++)
+		sr_release(gpio);
+	dimmer_sr_exit();
+
+	// bindings are gone, no more notification can be queued
+	irq_work_sync(&notify_irq_work);
+	cancel_work_sync(&notify_work);
+	genl_unregister_family(&ac_dimmer_genl_family);
 
+	debugfs_remove_recursive(ac_dimmer_debugfs);
 	class_unregister(&ac_dimmer_class);
+	free_page((unsigned long)status_page);
 	printk(KERN_INFO "AC dimmer disabled.\n");
 }
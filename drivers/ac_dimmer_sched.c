@@ -0,0 +1,431 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Firing schedule of the AC dimmer, kept apart from GPIO and
+ * timer calls: times are given by the caller, output levels
+ * are returned to it.
+*/
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "ac_button.h"
+#include "ac_dimmer_sched.h"
+
+/* Firing delay in 1/65536 of half period giving value percent of RMS power.
+ * Power conducted from delay d (fraction of half cycle) to its end is
+ * 1 - d + sin(2 pi d) / (2 pi), the table is its inverse, computed offline.
+ */
+static const u16 dimmer_power_delay[101] =
+{
+	65535, 57934, 55907, 54462, 53297, 52300, 51419, 50621, 49889, 49208,
+	48568, 47964, 47390, 46841, 46314, 45807, 45317, 44842, 44381, 43933,
+	43495, 43068, 42650, 42240, 41838, 41443, 41055, 40672, 40295, 39923,
+	39556, 39193, 38834, 38479, 38127, 37778, 37432, 37089, 36748, 36409,
+	36072, 35737, 35403, 35071, 34740, 34410, 34080, 33752, 33424, 33096,
+	32768, 32440, 32112, 31784, 31456, 31126, 30796, 30465, 30133, 29799,
+	29464, 29127, 28788, 28447, 28104, 27758, 27409, 27057, 26702, 26343,
+	25980, 25613, 25241, 24864, 24481, 24093, 23698, 23296, 22886, 22468,
+	22041, 21603, 21155, 20694, 20219, 19729, 19222, 18695, 18146, 17572,
+	16968, 16328, 15647, 14915, 14117, 13236, 12239, 11074,  9629,  7602,
+	    0,
+};
+
+/* Conducted fraction of full RMS power in 1/65536, for each curve and value,
+ * from the firing delay of the delay table : linear curve from the integral
+ * above, power curve by definition. Computed offline.
+ */
+static const u32 dimmer_conduct[DIMMER_CURVE_COUNT][101] =
+{
+	{
+		    0,   423,   423,   423,   423,   423,   423,   423,   423,   423,
+		  423,   560,   724,   916,  1138,  1392,  1679,  2001,  2359,  2754,
+		 3187,  3660,  4172,  4725,  5319,  5954,  6630,  7347,  8104,  8903,
+		 9741, 10618, 11534, 12487, 13476, 14499, 15556, 16645, 17764, 18910,
+		20084, 21281, 22500, 23739, 24996, 26268, 27553, 28847, 30150, 31458,
+		32768, 34078, 35386, 36689, 37983, 39268, 40540, 41797, 43036, 44255,
+		45452, 46626, 47772, 48891, 49980, 51037, 52060, 53049, 54002, 54918,
+		55795, 56633, 57432, 58189, 58906, 59582, 60217, 60811, 61364, 61876,
+		62349, 62782, 63177, 63535, 63857, 64144, 64398, 64620, 64812, 64976,
+		65113, 65227, 65318, 65390, 65444, 65482, 65508, 65524, 65533, 65536,
+		65536,
+	},
+	{
+		    0,   655,  1311,  1966,  2621,  3277,  3932,  4588,  5243,  5898,
+		 6554,  7209,  7864,  8520,  9175,  9830, 10486, 11141, 11796, 12452,
+		13107, 13763, 14418, 15073, 15729, 16384, 17039, 17695, 18350, 19005,
+		19661, 20316, 20972, 21627, 22282, 22938, 23593, 24248, 24904, 25559,
+		26214, 26870, 27525, 28180, 28836, 29491, 30147, 30802, 31457, 32113,
+		32768, 33423, 34079, 34734, 35389, 36045, 36700, 37356, 38011, 38666,
+		39322, 39977, 40632, 41288, 41943, 42598, 43254, 43909, 44564, 45220,
+		45875, 46531, 47186, 47841, 48497, 49152, 49807, 50463, 51118, 51773,
+		52429, 53084, 53740, 54395, 55050, 55706, 56361, 57016, 57672, 58327,
+		58982, 59638, 60293, 60948, 61604, 62259, 62915, 63570, 64225, 64881,
+		65536,
+	},
+};
+
+// round to the nearest slot
+static u32 dimmer_slot_round(u32 ns, u32 slot)
+{
+	return slot ? (ns + slot / 2) / slot * slot : ns;
+}
+
+// round up to a slot, pulses are only made longer
+static u32 dimmer_slot_up(u32 ns, u32 slot)
+{
+	return slot ? roundup(ns, slot) : ns;
+}
+
+/* Recompute firing delays for a new half period.
+ * max 90% of period for linear curve else it overlaps (timer delay ?)
+ * With a grid, delays are rounded to its slots : all channels of a phase
+ * share at most slots + 1 firing times, whatever their count.
+ */
+void dimmer_delay_table_update(struct dimmer_zc *zcd, u32 period)
+{
+	int value;
+	u32 slot;
+
+	if(period == 0 || abs((s32)(period - zcd->delay_table_period)) <= (zcd->delay_table_period >> DELAY_TABLE_SHIFT))
+		return;
+
+	slot = zcd->slots ? period / zcd->slots : 0;
+	for(value = 0; value <= 100; ++value)
+	{
+		zcd->delay_table[DIMMER_CURVE_LINEAR][value] = dimmer_slot_round(div_u64((u64)period * min(90, 100 - value), 100), slot);
+		zcd->delay_table[DIMMER_CURVE_POWER][value] = dimmer_slot_round(((u64)period * dimmer_power_delay[value]) >> 16, slot);
+	}
+
+	zcd->slot = slot;
+	zcd->delay_table_period = period;
+}
+
+/* Insert a dimmer at its next_tick position.
+ * Toggles are mostly scheduled in increasing order, so the
+ * insertion point is usually near the end.
+ */
+void dimmer_run_queue_insert(struct dimmer_run_queue *queue, struct dimmer_desc *desc)
+{
+	unsigned int index = queue->count++;
+
+	while(index > 0 && queue->items[index-1]->next_tick.tv64 < desc->next_tick.tv64)
+	{
+		queue->items[index] = queue->items[index-1];
+		--index;
+	}
+	queue->items[index] = desc;
+}
+
+void dimmer_run_queue_remove(struct dimmer_run_queue *queue, struct dimmer_desc *desc)
+{
+	unsigned int index;
+
+	for(index = 0; index < queue->count; ++index)
+	{
+		if(queue->items[index] != desc)
+			continue;
+		memmove(queue->items + index, queue->items + index + 1, (queue->count - index - 1) * sizeof(*queue->items));
+		--queue->count;
+		break;
+	}
+
+	desc->next_tick = ktime_set(0,0);
+}
+
+void dimmer_run_queue_drop_zc(struct dimmer_run_queue *queue, unsigned int zc)
+{
+	unsigned int index;
+	unsigned int kept;
+
+	for(index = 0, kept = 0; index < queue->count; ++index)
+	{
+		if(queue->items[index]->zc != zc)
+			queue->items[kept++] = queue->items[index];
+	}
+	queue->count = kept;
+}
+
+struct dimmer_desc *dimmer_run_queue_pop(struct dimmer_run_queue *queue, ktime_t limit)
+{
+	struct dimmer_desc *desc;
+
+	if(queue->count == 0)
+		return NULL;
+
+	desc = queue->items[queue->count-1];
+	if(desc->next_tick.tv64 > limit.tv64)
+		return NULL;
+
+	--queue->count;
+	return desc;
+}
+
+ktime_t dimmer_run_queue_next(const struct dimmer_run_queue *queue)
+{
+	if(queue->count == 0)
+		return ktime_set(0,0);
+	return queue->items[queue->count-1]->next_tick;
+}
+
+/* Lateness allowed to the pending toggle of a dimmer : only the end of a
+ * leading edge gate pulse, a triac keeps conducting once triggered. In a
+ * train it stays far below the gap to the next pulse, so that batching
+ * never merges them.
+ */
+static u32 dimmer_sched_slack(const struct dimmer_desc *desc, u32 slack)
+{
+	if(desc->mode != DIMMER_MODE_LEADING || desc->gpio_value == 0)
+		return 0;
+	if(desc->pulse_left > 1)
+		return min(slack, (desc->pulse_period - desc->pulse_width) / 4);
+	return slack;
+}
+
+/* The earliest toggle is due at its time plus its slack, unless another
+ * toggle is due before : it is then fired along with that one, which
+ * saves a timer event per gate pulse end riding another toggle.
+ */
+ktime_t dimmer_run_queue_expiry(const struct dimmer_run_queue *queue, u32 slack)
+{
+	const struct dimmer_desc *desc;
+	unsigned int index = queue->count;
+	s64 expiry = S64_MAX;
+
+	while(index-- > 0)
+	{
+		desc = queue->items[index];
+		if(desc->next_tick.tv64 >= expiry)
+			break;
+		expiry = min(expiry, desc->next_tick.tv64 + dimmer_sched_slack(desc, slack));
+	}
+
+	return ns_to_ktime(queue->count ? expiry : 0);
+}
+
+/* Trailing edge conducts from the crossing for as long as leading edge
+ * would conduct after its firing delay, so that curves keep their meaning.
+ * Cut off is kept a gate pulse before the next crossing.
+ */
+static u32 dimmer_sched_cutoff(const struct dimmer_desc *desc, const struct dimmer_zc *zcd, u32 period)
+{
+	u32 delay = zcd->delay_table[desc->curve][desc->value];
+	u32 cutoff;
+
+	if(delay >= period)
+		return 0;
+	cutoff = min_t(u32, period - delay, period > DIMMER_GATE_PULSE ? period - DIMMER_GATE_PULSE : 0);
+
+	// down to the grid, never closer to the next crossing
+	return zcd->slot ? cutoff - cutoff % zcd->slot : cutoff;
+}
+
+/* Burst mode is decided once per full cycle, so that the load never
+ * sees a DC component. Each cycle owes value percent, a cycle is on
+ * once a whole one is owed, which spreads on cycles evenly.
+ */
+static int dimmer_sched_burst(struct dimmer_desc *desc)
+{
+	desc->burst_half = !desc->burst_half;
+	if(!desc->burst_half)
+		return desc->gpio_value;
+
+	desc->burst_error += desc->value;
+	if(desc->burst_error >= 100)
+	{
+		desc->burst_error -= 100;
+		return desc->gpio_value = 1;
+	}
+	return desc->gpio_value = 0;
+}
+
+int dimmer_sched_crossing(struct dimmer_desc *desc, const struct dimmer_zc *zcd, u32 period, ktime_t crossing, ktime_t now)
+{
+	u32 cutoff;
+
+	// reset timer
+	desc->next_tick = ktime_set(0,0);
+	desc->slot = zcd->slot;
+
+	// switched at crossings only, no timer event
+	if(desc->mode == DIMMER_MODE_BURST)
+		return dimmer_sched_burst(desc);
+
+	// full time on
+	if(desc->value == 100)
+		return desc->gpio_value = 1;
+
+	// period start low
+	desc->gpio_value = 0;
+
+	// full time off or no period
+	if(desc->value == 0 || period == 0)
+		return 0;
+
+	if(desc->mode == DIMMER_MODE_TRAILING)
+	{
+		// period start high, single cut off event
+		cutoff = dimmer_sched_cutoff(desc, zcd, period);
+		if(cutoff == 0)
+			return 0;
+		desc->cutoff = cutoff;
+
+		// the phase corrected crossing follows the leave edge of a level
+		// detector switching above zero : switching on now would conduct
+		// at the end of the previous half period, so on is a toggle at the
+		// crossing. Those half periods cost two timer events instead of one.
+		if(crossing.tv64 > now.tv64)
+		{
+			desc->next_tick = crossing;
+			return 0;
+		}
+
+		desc->next_tick = ktime_add_ns(crossing, cutoff);
+		return desc->gpio_value = 1;
+	}
+
+	// timer setup
+	desc->next_tick = ktime_add_ns(crossing, zcd->delay_table[desc->curve][desc->value]);
+	desc->pulse_left = desc->pulse_count;
+	return 0;
+}
+
+/* Leading edge : gate on then off after the pulse, for each pulse of the train.
+ * Trailing edge : the cut off, preceded by the switch on when the crossing
+ * was still ahead at the detector edge (level detector leave edges).
+ * A train still running at the next crossing is dropped with the run queue.
+ */
+int dimmer_sched_toggle(struct dimmer_desc *desc)
+{
+	u32 width;
+
+	if(desc->gpio_value == 0)
+	{
+		desc->gpio_value = 1;
+		desc->next_tick = ktime_add_ns(desc->next_tick, desc->mode == DIMMER_MODE_TRAILING ? desc->cutoff : dimmer_slot_up(desc->pulse_width, desc->slot));
+	}
+	else if(desc->mode == DIMMER_MODE_LEADING && desc->pulse_left > 1)
+	{
+		// pulses of a train stay on the grid, and apart
+		width = dimmer_slot_up(desc->pulse_width, desc->slot);
+		desc->gpio_value = 0;
+		--desc->pulse_left;
+		desc->next_tick = ktime_add_ns(desc->next_tick, max(dimmer_slot_up(desc->pulse_period, desc->slot), width + desc->slot) - width);
+	}
+	else
+	{
+		desc->gpio_value = 0;
+		// remove trigger
+		desc->next_tick = ktime_set(0,0);
+	}
+
+	return desc->gpio_value;
+}
+
+/* A half period conducts from its firing, or from its start when it is
+ * high (trailing edge, full on, burst on), unless nothing is scheduled.
+ */
+void dimmer_sched_account(struct dimmer_desc *desc, int level)
+{
+	++desc->half_cycles;
+
+	if(!level && !desc->next_tick.tv64)
+		return;
+
+	if(desc->mode == DIMMER_MODE_BURST)
+		desc->energy += 65536;
+	else
+		desc->energy += dimmer_conduct[desc->curve][desc->value];
+}
+
+void dimmer_jitter_reset(struct dimmer_jitter *jitter)
+{
+	memset(jitter, 0, sizeof(*jitter));
+}
+
+/* Only counters and a shift on the firing path,
+ * so that it can stay enabled in production.
+ */
+void dimmer_jitter_record(struct dimmer_jitter *jitter, int level, s64 delta)
+{
+	int bucket;
+
+	level = !!level;
+
+	if(delta > S32_MAX)
+		delta = S32_MAX;
+	if(delta < S32_MIN)
+		delta = S32_MIN;
+
+	if(jitter->count[level] == 0 || delta < jitter->min[level])
+		jitter->min[level] = delta;
+	if(jitter->count[level] == 0 || delta > jitter->max[level])
+		jitter->max[level] = delta;
+	++jitter->count[level];
+
+	if(delta < 0)
+	{
+		++jitter->early[level];
+		return;
+	}
+
+	// bucket 0 : < 1us, bucket n : < 2^n us
+	bucket = fls((u32)delta >> 10);
+	if(bucket >= DIMMER_JITTER_BUCKETS)
+		bucket = DIMMER_JITTER_BUCKETS - 1;
+	++jitter->buckets[level][bucket];
+}
+
+static int dimmer_binding_toggle(struct dimmer_binding *binding, int value)
+{
+	if(value > 0)
+	{
+		binding->last_value = value;
+		return 0;
+	}
+	return binding->last_value > 0 ? binding->last_value : 100;
+}
+
+int dimmer_binding_action(struct dimmer_binding *binding, int status, int value)
+{
+	switch(binding->action)
+	{
+	case DIMMER_BINDING_TOGGLE:
+		if(status & AC_BUTTON_STATUS_PRESS)
+			value = dimmer_binding_toggle(binding, value);
+		break;
+
+	case DIMMER_BINDING_STEP:
+		if(status & AC_BUTTON_STATUS_PRESS)
+			value = value >= 100 ? 0 : min(value + binding->arg, 100);
+		break;
+
+	case DIMMER_BINDING_FADE:
+		if(status & AC_BUTTON_STATUS_PRESS)
+			binding->fade_held = 0;
+		if((status & AC_BUTTON_STATUS_RELEASE) && !binding->fade_held)
+			value = dimmer_binding_toggle(binding, value);
+		if(status & AC_BUTTON_STATUS_HOLD)
+		{
+			if(!binding->fade_held)
+			{
+				// new hold : reverse, unless at a bound
+				binding->fade_held = 1;
+				if(value <= 0)
+					binding->fade_dir = 1;
+				else if(value >= 100)
+					binding->fade_dir = -1;
+				else
+					binding->fade_dir = -binding->fade_dir;
+			}
+			value = clamp(value + binding->fade_dir * binding->arg, 0, 100);
+		}
+		break;
+	}
+
+	return value;
+}
@@ -0,0 +1,181 @@
+#ifndef __MYLIFE_AC_DIMMER_SCHED_H__
+#define __MYLIFE_AC_DIMMER_SCHED_H__
+
+#include <linux/ktime.h>
+
+struct device;
+struct gpio_desc;
+struct dentry;
+
+// default gate pulse duration
+#define DIMMER_GATE_PULSE 300000
+
+// gate pulse bounds (ns), and max pulses of a train
+#define DIMMER_PULSE_MIN   10000
+#define DIMMER_PULSE_MAX   5000000
+#define DIMMER_PULSE_COUNT 32
+
+#define DIMMER_CURVE_LINEAR 0 // value is percent of period delay
+#define DIMMER_CURVE_POWER  1 // value is percent of RMS power
+#define DIMMER_CURVE_COUNT  2
+
+#define DIMMER_MODE_LEADING  0 // triac : gate pulse at firing delay
+#define DIMMER_MODE_TRAILING 1 // MOSFET/IGBT : on at crossing, off at end of conduction
+#define DIMMER_MODE_BURST    2 // resistive loads : whole cycles on or off, value percent of them
+#define DIMMER_MODE_COUNT    3
+
+/* dimmer_zc
+ *
+ * This structure maintains the information regarding a zero
+ * crossing detector (one per mains phase):
+ * delay_table : firing delay in ns for each curve and value, for the
+ *               half period it has been computed for. It is rebuilt from
+ *               the zero crossing handler only when the measured period
+ *               drifts by more than 1/2^DELAY_TABLE_SHIFT.
+ * slots       : firing grid, the half period is divided in that many slots
+ *               of slot ns and all toggles fall on them, 0 for no grid.
+ */
+#define DELAY_TABLE_SHIFT 10
+struct dimmer_zc
+{
+	unsigned int zc;
+	int id; // ac_zc registration
+	u32 delay_table[DIMMER_CURVE_COUNT][101];
+	u32 delay_table_period;
+	unsigned int slots;
+	u32 slot;
+};
+
+/* dimmer_jitter
+ *
+ * Firing jitter of a dimmer, gate on ([1]) and gate off ([0]) apart:
+ * delay between the target toggle time and the actual GPIO write,
+ * bucket n counts delays below 2^n us (last bucket has all above).
+ * Toggles fired ahead of time by batching are counted in early, gate
+ * pulse ends delayed to ride a later toggle are counted as late.
+ */
+#define DIMMER_JITTER_BUCKETS 16
+struct dimmer_jitter
+{
+	u32 buckets[2][DIMMER_JITTER_BUCKETS];
+	u32 early[2];
+	u32 count[2];
+	s32 min[2];
+	s32 max[2];
+};
+
+/* dimmer_binding
+ *
+ * Action run on a dimmer from the ac_button sampling path:
+ * toggle : each press switches off, or back on to the last value
+ * step   : each press adds arg percent, wrapping to 0 past 100
+ * fade   : a short press toggles, holding changes the value by arg
+ *          percent per sampling interval, direction alternates
+ */
+#define DIMMER_BINDING_NONE   0
+#define DIMMER_BINDING_TOGGLE 1
+#define DIMMER_BINDING_STEP   2
+#define DIMMER_BINDING_FADE   3
+#define DIMMER_BINDING_COUNT  4
+struct dimmer_binding
+{
+	int action; // DIMMER_BINDING_*
+	unsigned int gpio;
+	int arg;
+	int id; // ac_button registration
+	int last_value;
+	int fade_dir;
+	int fade_held;
+};
+
+/* dimmer_desc
+ *
+ * This structure maintains the information regarding a
+ * single AC dimmer triac command signal:
+ * value : 0 - 100
+ * curve : DIMMER_CURVE_*
+ * mode  : DIMMER_MODE_*
+ * zc    : index of the zero crossing detector of its mains phase
+ * pulse_width, pulse_count, pulse_period : leading edge gate pulse
+ *         (ns), repeated pulse_count times every pulse_period (ns)
+ */
+struct dimmer_desc
+{
+	struct device *dev;
+	unsigned int gpio;
+	struct gpio_desc *gpiod; // cached at export, avoids lookups when firing
+	int value;
+	int curve;
+	int mode;
+	unsigned int zc;
+	unsigned int engine;   // firing timer, see ac_dimmer_engines
+	int gpio_value;
+	ktime_t next_tick;     // timer tick at which next toggling should happen
+	int burst_error;       // burst mode : cycles owed (percent), error diffusion
+	int burst_half;        // burst mode : second half of the current cycle
+	u32 pulse_width;
+	unsigned int pulse_count;
+	u32 pulse_period;
+	unsigned int pulse_left; // pulses of the train still to fire
+	u32 cutoff;            // trailing edge : conduction time from the crossing
+	u32 slot;              // firing grid step of its phase at the last crossing, 0 for none
+	u64 energy;            // conducted half periods at full RMS power, in 1/65536
+	u64 half_cycles;       // half periods accounted in energy
+	struct dimmer_jitter jitter;
+	struct dimmer_binding binding;
+	ktime_t changed;       // last value change by a binding, for notification
+	struct dentry *debugfs;
+	unsigned long flags;   // only FLAG_ACDIMMER is used, for synchronizing inside module
+#define FLAG_ACDIMMER 1
+#define FLAG_NOTIFY   2
+};
+
+/* dimmer_run_queue
+ *
+ * Pending toggles, sorted by descending next_tick so that
+ * the earliest is popped from the end.
+ */
+struct dimmer_run_queue
+{
+	struct dimmer_desc **items;
+	unsigned int count;
+};
+
+// rebuild delay table if period (half mains period, ns) drifted
+void dimmer_delay_table_update(struct dimmer_zc *zcd, u32 period);
+
+void dimmer_run_queue_insert(struct dimmer_run_queue *queue, struct dimmer_desc *desc);
+void dimmer_run_queue_remove(struct dimmer_run_queue *queue, struct dimmer_desc *desc);
+
+// remove all pending toggles of a mains phase
+void dimmer_run_queue_drop_zc(struct dimmer_run_queue *queue, unsigned int zc);
+
+// return : earliest pending toggle if it is due at limit, NULL otherwise
+struct dimmer_desc *dimmer_run_queue_pop(struct dimmer_run_queue *queue, ktime_t limit);
+
+// return : earliest pending toggle time, 0 if none
+ktime_t dimmer_run_queue_next(const struct dimmer_run_queue *queue);
+
+// return : latest time the earliest pending toggles can be fired, gate pulse
+// ends being allowed slack ns late (see dimmer_run_queue_expiry()), 0 if none
+ktime_t dimmer_run_queue_expiry(const struct dimmer_run_queue *queue, u32 slack);
+
+// return : output level at now, for the crossing at crossing (which may still be ahead),
+// next_tick is set if a toggle follows
+int dimmer_sched_crossing(struct dimmer_desc *desc, const struct dimmer_zc *zcd, u32 period, ktime_t crossing, ktime_t now);
+
+// return : output level at a due toggle, next_tick is set if another toggle follows
+int dimmer_sched_toggle(struct dimmer_desc *desc);
+
+// account the half period scheduled by dimmer_sched_crossing(), which returned level
+void dimmer_sched_account(struct dimmer_desc *desc, int level);
+
+// return : dimmer value after a button event (AC_BUTTON_STATUS_*) on its binding
+int dimmer_binding_action(struct dimmer_binding *binding, int status, int value);
+
+void dimmer_jitter_reset(struct dimmer_jitter *jitter);
+
+// record a toggle to level, delta = actual - target (ns)
+void dimmer_jitter_record(struct dimmer_jitter *jitter, int level, s64 delta);
+
+#endif // __MYLIFE_AC_DIMMER_SCHED_H__
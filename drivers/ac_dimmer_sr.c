@@ -0,0 +1,133 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Shift register output backend of the AC dimmer : gates are driven
+ * through a chain of 74HC595 on three bit-banged GPIO pins, so that
+ * a few pins drive many dimmers. Outputs are changed in memory by the
+ * firing paths, and shifted out once per batch of toggles.
+*/
+
+#include <linux/kernel.h>
+#include <linux/gpio.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
+
+#include "ac_dimmer_sr.h"
+
+/* Chain state, protected by sr_lock. Engines may flush from
+ * several CPUs, the lock also serializes the pin sequences.
+ */
+static struct gpio_desc *sr_data;
+static struct gpio_desc *sr_clock;
+static struct gpio_desc *sr_latch;
+static unsigned int sr_bits = 0;
+static DECLARE_BITMAP(sr_state, DIMMER_SR_MAX_BITS);
+static int sr_dirty;
+static DEFINE_RAW_SPINLOCK(sr_lock);
+
+static int sr_request(unsigned int gpio, struct gpio_desc **desc)
+{
+	int status;
+
+	status = gpio_request(gpio, "ac_dimmer_sr");
+	if(status < 0)
+		return status;
+
+	*desc = gpio_to_desc(gpio);
+	status = gpiod_direction_output_raw(*desc, 0);
+	if(status < 0)
+		gpio_free(gpio);
+	return status;
+}
+
+int dimmer_sr_init(unsigned int data, unsigned int clock, unsigned int latch, unsigned int bits)
+{
+	int status;
+
+	if(bits == 0 || bits > DIMMER_SR_MAX_BITS)
+		return -EINVAL;
+
+	status = sr_request(data, &sr_data);
+	if(status < 0)
+		goto fail_safe;
+
+	status = sr_request(clock, &sr_clock);
+	if(status < 0)
+		goto fail_after_data;
+
+	status = sr_request(latch, &sr_latch);
+	if(status < 0)
+		goto fail_after_clock;
+
+	sr_bits = bits;
+	bitmap_zero(sr_state, DIMMER_SR_MAX_BITS);
+	sr_dirty = 1;
+	dimmer_sr_flush();
+
+	printk(KERN_INFO "AC dimmer shift register: %u outputs\n", bits);
+	return 0;
+
+fail_after_clock:
+	gpio_free(desc_to_gpio(sr_clock));
+fail_after_data:
+	gpio_free(desc_to_gpio(sr_data));
+fail_safe:
+	pr_debug("%s: status %d\n", __func__, status);
+	return status;
+}
+
+void dimmer_sr_exit(void)
+{
+	if(sr_bits == 0)
+		return;
+
+	gpio_free(desc_to_gpio(sr_latch));
+	gpio_free(desc_to_gpio(sr_clock));
+	gpio_free(desc_to_gpio(sr_data));
+	sr_bits = 0;
+}
+
+void dimmer_sr_set(unsigned int bit, int level)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&sr_lock, flags);
+	if(!!test_bit(bit, sr_state) != !!level)
+	{
+		__change_bit(bit, sr_state);
+		sr_dirty = 1;
+	}
+	raw_spin_unlock_irqrestore(&sr_lock, flags);
+}
+
+/* The last register of the chain receives the first shifted bit,
+ * so bits are shifted from the highest : bit n is output Qn%8 of
+ * register n/8, counted from the one wired to data.
+ */
+void dimmer_sr_flush(void)
+{
+	unsigned long flags;
+	unsigned int bit;
+
+	if(!READ_ONCE(sr_dirty))
+		return;
+
+	raw_spin_lock_irqsave(&sr_lock, flags);
+
+	if(sr_dirty)
+	{
+		for(bit = sr_bits; bit-- > 0;)
+		{
+			gpiod_set_raw_value(sr_data, test_bit(bit, sr_state));
+			gpiod_set_raw_value(sr_clock, 1);
+			gpiod_set_raw_value(sr_clock, 0);
+		}
+		gpiod_set_raw_value(sr_latch, 1);
+		gpiod_set_raw_value(sr_latch, 0);
+		sr_dirty = 0;
+	}
+
+	raw_spin_unlock_irqrestore(&sr_lock, flags);
+}
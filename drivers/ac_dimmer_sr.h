@@ -0,0 +1,19 @@
+#ifndef __MYLIFE_AC_DIMMER_SR_H__
+#define __MYLIFE_AC_DIMMER_SR_H__
+
+// max outputs of the shift register chain (8 per 74HC595)
+#define DIMMER_SR_MAX_BITS 64
+
+// setup the chain on its GPIO pins, outputs are cleared
+// return : 0 on success, error < 0 on failure
+int dimmer_sr_init(unsigned int data, unsigned int clock, unsigned int latch, unsigned int bits);
+
+void dimmer_sr_exit(void);
+
+// change an output level, it is applied by the next dimmer_sr_flush()
+void dimmer_sr_set(unsigned int bit, int level);
+
+// shift all outputs to the chain and latch them, only if one changed
+void dimmer_sr_flush(void);
+
+#endif // __MYLIFE_AC_DIMMER_SR_H__
@@ -0,0 +1,125 @@
+#ifndef __MYLIFE_AC_USER_H__
+#define __MYLIFE_AC_USER_H__
+
+/* Definitions shared with userspace programs */
+
+#include <linux/types.h>
+
+// one zero crossing detector per mains phase
+#define AC_ZC_MAX_DETECTORS 4
+
+/* ac_zc_trace_record
+ *
+ * Raw detector edge, as read from /dev/ac_zc_trace while capturing,
+ * and as written to it to be replayed.
+ */
+struct ac_zc_trace_record
+{
+	__u64 time;  // ns, monotonic clock
+	__u32 zc;    // detector index
+	__u32 value; // detector level after the edge
+};
+
+/* Status pages
+ *
+ * /dev/ac_zc_status, /dev/ac_dimmer_status and /dev/ac_button_status
+ * can be mapped read-only (one page) to sample the state of each
+ * module with plain memory loads. seq is odd while the kernel updates
+ * the entries it protects, a reader retries until it reads the same
+ * even seq before and after copying them:
+ *
+ *   do {
+ *     while((seq = status->seq) & 1);
+ *     rmb();
+ *     copy = status->...;
+ *     rmb();
+ *   } while(seq != status->seq);
+ */
+#define AC_STATUS_PAGE_SIZE 4096
+
+struct ac_zc_status_detector
+{
+	__u32 seq;
+	__u32 period;   // ns
+	__u64 crossing; // ns, monotonic clock
+	__u32 freq;     // Hz
+	__u32 rejected;
+};
+
+// each detector has its own seq, detectors are updated from their own interrupt
+struct ac_zc_status
+{
+	__u32 count;
+	__u32 reserved;
+	struct ac_zc_status_detector detectors[AC_ZC_MAX_DETECTORS];
+};
+
+#define AC_STATUS_MAX_CHANNELS 128
+
+// dimmers on the shift register chain are identified as AC_DIMMER_SR + output
+#define AC_DIMMER_SR 0x10000
+
+struct ac_dimmer_status_channel
+{
+	__u32 gpio;     // or AC_DIMMER_SR + output
+	__s32 value;
+	__u32 curve;
+	__u32 zc;
+};
+
+struct ac_dimmer_status
+{
+	__u32 seq;
+	__u32 count;
+	struct ac_dimmer_status_channel channels[AC_STATUS_MAX_CHANNELS];
+};
+
+struct ac_button_status_button
+{
+	__u32 gpio;
+	__s32 value;
+	__u32 presses;
+	__u32 latency; // ns
+};
+
+struct ac_button_status
+{
+	__u32 seq;
+	__u32 count;
+	struct ac_button_status_button buttons[AC_STATUS_MAX_CHANNELS];
+};
+
+/* Generic netlink
+ *
+ * ac_button and ac_dimmer each register a family of their name, with an
+ * "events" multicast group. Each button transition and each dimmer
+ * value change is multicast there as an AC_CMD_EVENT message.
+ * AC_CMD_GET with AC_ATTR_GPIO is answered with the same message, so
+ * that a subscriber can read initial values.
+ */
+#define AC_BUTTON_GENL_NAME  "ac_button"
+#define AC_DIMMER_GENL_NAME  "ac_dimmer"
+#define AC_GENL_VERSION      1
+#define AC_GENL_MCGRP_EVENTS "events"
+
+enum
+{
+	AC_CMD_UNSPEC,
+	AC_CMD_EVENT,
+	AC_CMD_GET,
+	__AC_CMD_MAX,
+};
+#define AC_CMD_MAX (__AC_CMD_MAX - 1)
+
+enum
+{
+	AC_ATTR_UNSPEC,
+	AC_ATTR_GPIO,  // u32
+	AC_ATTR_VALUE, // s32
+	AC_ATTR_TIME,  // u64, ns, monotonic clock
+	AC_ATTR_PAD,
+	__AC_ATTR_MAX,
+};
+#define AC_ATTR_MAX (__AC_ATTR_MAX - 1)
+
+#endif // __MYLIFE_AC_USER_H__
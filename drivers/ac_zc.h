@@ -1,17 +1,34 @@
 #ifndef __MYLIFE_AC_ZC_H__
 #define __MYLIFE_AC_ZC_H__
 
+#include <linux/ktime.h>
+
+#include "ac_user.h"
+
 #define AC_ZC_STATUS_ENTER (1 << 0)
 #define AC_ZC_STATUS_LEAVE (1 << 1)
+#define AC_ZC_STATUS_CROSSING (1 << 2) // mains crossing (both polarities), see ac_zc_crossing()
 
 typedef void (*ac_zc_callback)(int status, void *data);
 
+// return : count of detectors, they are identified by their index
+int ac_zc_count(void);
+
 // return : id > 0 on success (to unregister), error < 0 on failure
-int ac_zc_register(int status, ac_zc_callback cb, void *cb_data);
+int ac_zc_register(unsigned int zc, int status, ac_zc_callback cb, void *cb_data);
 
 // return : 0 on success, error < 0 on failure
-int ac_zc_unregister(int id);
+int ac_zc_unregister(unsigned int zc, int id);
+
+int ac_zc_freq(unsigned int zc);
+
+// return : smoothed mains period in ns, 0 if not measured yet
+u32 ac_zc_period(unsigned int zc);
+
+// return : phase corrected time of the last mains crossing
+ktime_t ac_zc_crossing(unsigned int zc);
 
-int ac_zc_freq(void);
+// return : smoothed detector pulse (or high level) width in ns
+u32 ac_zc_pulse_width(unsigned int zc);
 
 #endif // __MYLIFE_AC_ZC_H__
@@ -21,20 +21,53 @@
 #include <linux/irq.h>
 #include <linux/math64.h>
 #include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/irq_work.h>
+#include <linux/cpumask.h>
 
 #include "ac_common.h"
 #include "ac_zc.h"
+#include "ac_user.h"
 
 #define get_ktime_secs(ktime) (div_s64((ktime).tv64, NSEC_PER_SEC))
 #define get_now_secs() get_ktime_secs(ktime_get())
 
-static int ac_zc_gpio = -1;
-static int ac_zc_irq = -1;
+// one GPIO per detector (one per mains phase)
+static int ac_zc_gpio[AC_ZC_MAX_DETECTORS] = { [0 ... AC_ZC_MAX_DETECTORS-1] = -1 };
+static unsigned int ac_zc_gpio_count = 0;
 
-static int ac_zc_freq_value = 0;
-static int ac_zc_freq_counter = 0;
-static s64 ac_zc_freq_start;
-static int ac_zc_gpio_previous_value;
+// detector kind : 0 = level following mains polarity, 1 = pulse centered on each crossing
+static int ac_zc_pulse = 0;
+
+// virtual detector, generating crossings from a timer instead of a GPIO:
+// frequency (0 = none), edge jitter, frequency offset, dropped edges and pulse width
+static unsigned int ac_zc_virtual_freq = 0;
+static unsigned int ac_zc_virtual_jitter = 0;
+static int ac_zc_virtual_drift = 0;
+static unsigned int ac_zc_virtual_drop = 0;
+static unsigned int ac_zc_virtual_width = 400000;
+
+// replay detector, fed with records written to the trace device : a capture
+// holds the edges of all detectors, only those of one recorded detector are played
+static int ac_zc_replay = 0;
+static unsigned int ac_zc_replay_zc = 0;
+
+// edges closer than this percentage of the expected spacing to the previous
+// accepted edge are noise, 0 to disable
+static unsigned int ac_zc_min_interval = 40;
+
+// mains period and width (high level or pulse duration) tracking,
+// smoothed over 2^AC_ZC_TRACK_SHIFT samples
+#define AC_ZC_TRACK_SHIFT 3
+
+// consecutive missing / extra intervals after which tracking follows them
+// anyway, as the tracked period is then the wrong one
+#define AC_ZC_RESYNC 16
 
 struct ac_zc_cb_desc
 {
@@ -43,15 +76,150 @@ struct ac_zc_cb_desc
 	ac_zc_callback cb;
 };
 
+/* ac_zc_window
+ *
+ * Mains period statistics over a fixed window, accumulated per crossing
+ * and published to result when the window ends. Deviations are summed
+ * from ref, the period at window start, so that squares do not overflow.
+ */
+#define AC_ZC_WINDOW_COUNT 3
+
+struct ac_zc_window_result
+{
+	u32 count;
+	u32 min;      // ns
+	u32 max;      // ns
+	u32 mean;     // ns
+	u64 variance; // ns^2
+};
+
+struct ac_zc_window
+{
+	ktime_t start;
+	u32 count;
+	u32 min;
+	u32 max;
+	u32 ref;
+	s64 sum;
+	u64 sumsq;
+	struct ac_zc_window_result result;
+};
+
+static const s64 ac_zc_window_ns[AC_ZC_WINDOW_COUNT] = { NSEC_PER_SEC, 60 * NSEC_PER_SEC, 900 * NSEC_PER_SEC };
+static const char *const ac_zc_window_names[AC_ZC_WINDOW_COUNT] = { "stats_1s", "stats_1min", "stats_15min" };
+
 // TODO : resizable list ?
 #define ZC_DESCRIPTOR_SIZE 16
-static struct ac_zc_cb_desc zc_descriptors[ZC_DESCRIPTOR_SIZE];
+
+/* ac_zc_detector
+ *
+ * This structure maintains the information regarding a
+ * single zero crossing detector, with its own callbacks
+ */
+#define AC_ZC_SOURCE_GPIO    0
+#define AC_ZC_SOURCE_VIRTUAL 1
+#define AC_ZC_SOURCE_REPLAY  2
+
+struct ac_zc_detector
+{
+	unsigned int index;
+	int source; // AC_ZC_SOURCE_*
+	int gpio;   // -1 if not AC_ZC_SOURCE_GPIO
+	struct gpio_desc *gpiod; // cached at setup, avoids lookups from the IRQ handler
+	int irq;
+	int cpu;      // IRQ affinity, -1 for any CPU
+	int last_cpu; // CPU that handled the last edge
+
+	// virtual and replay detectors timer
+	struct hrtimer timer;
+
+	// virtual detector generator : ideal time of next crossing, next edge level
+	ktime_t virtual_crossing;
+	int virtual_value;
+
+	// replay detector : offset from recorded to replayed time
+	s64 replay_offset;
+
+	// corresponding sysfs device
+	struct device *dev;
+
+	int gpio_previous_value;
+
+	int freq_value;
+	int freq_counter;
+	s64 freq_start;
+
+	unsigned int rejected;
+
+	// mains quality : crossings missed, or too early to be mains ones
+	unsigned int missing;
+	unsigned int extra;
+	unsigned int outliers; // consecutive missing / extra intervals
+	u32 stats_seq; // windows results, see ac_status_write_begin()
+	struct ac_zc_window windows[AC_ZC_WINDOW_COUNT];
+
+	// time spent handling an edge, callbacks included
+	u32 dispatch_max;
+	u32 dispatch_count;
+	u64 dispatch_total;
+	int dispatch_reset; // requested from sysfs, done by the next edge
+
+	ktime_t last_enter;
+	ktime_t last_leave;
+	u32 period;
+	u32 width;
+
+	// phase corrected time of the last mains crossing
+	ktime_t crossing;
+
+	struct ac_zc_cb_desc descriptors[ZC_DESCRIPTOR_SIZE];
+};
+
+static struct ac_zc_detector ac_zc_detectors[AC_ZC_MAX_DETECTORS];
+static unsigned int ac_zc_detector_count = 0;
 
 // lock protects against ac_zc_register() / ac_zc_unregister()
 static DEFINE_MUTEX(ac_zc_descriptors_lock);
 
+/* trace device
+ *
+ * While it is open for reading, raw edges of all detectors are
+ * captured into ac_zc_capture. Records of detector ac_zc_replay_zc
+ * written to it are queued into ac_zc_replay_fifo and played by the
+ * replay detector.
+ */
+#define AC_ZC_TRACE_SIZE 1024
+static DECLARE_KFIFO(ac_zc_capture, struct ac_zc_trace_record, AC_ZC_TRACE_SIZE);
+static DECLARE_KFIFO(ac_zc_replay_fifo, struct ac_zc_trace_record, AC_ZC_TRACE_SIZE);
+static DEFINE_RAW_SPINLOCK(ac_zc_capture_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ac_zc_capture_wait);
+static DECLARE_WAIT_QUEUE_HEAD(ac_zc_replay_wait);
+static struct irq_work ac_zc_trace_wake; // waking up is not allowed in hard context on PREEMPT_RT
+static DEFINE_MUTEX(ac_zc_replay_lock);
+static unsigned long ac_zc_trace_flags;
+#define FLAG_CAPTURE 0
+static unsigned int ac_zc_capture_overrun = 0;
+static struct ac_zc_detector *ac_zc_replay_detector = NULL;
+
+// status page, mapped by /dev/ac_zc_status readers
+static struct ac_zc_status *ac_zc_status_page = NULL;
+
+static ssize_t ac_zc_show(struct ac_zc_detector *detector, const char *name, char *buf);
 static ssize_t ac_zc_attr_show(struct class *class, struct class_attribute *attr, char *buf);
+static ssize_t ac_zc_dev_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t ac_zc_store(struct ac_zc_detector *detector, const char *name, const char *buf, size_t len);
+static ssize_t ac_zc_attr_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len);
+static ssize_t ac_zc_dev_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len);
+static s32 ac_zc_edge_offset(struct ac_zc_detector *detector);
+static void ac_zc_edge(struct ac_zc_detector *detector, int gpio_value, ktime_t now);
+static void ac_zc_capture_edge(struct ac_zc_detector *detector, int gpio_value, ktime_t now);
+static void ac_zc_status_update(struct ac_zc_detector *detector);
+static int ac_zc_quality(struct ac_zc_detector *detector, s64 interval, ktime_t now);
+static void ac_zc_window_add(struct ac_zc_window *window, s64 duration, u32 sample, ktime_t now);
+static ssize_t ac_zc_window_show(struct ac_zc_detector *detector, unsigned int index, char *buf);
 static irqreturn_t ac_zc_irq_handler(int irq, void *dev_id);
+static enum hrtimer_restart ac_zc_virtual_callback(struct hrtimer *timer);
+static enum hrtimer_restart ac_zc_replay_callback(struct hrtimer *timer);
 static int ac_zc_init(void);
 static void ac_zc_exit(void);
 
@@ -59,24 +227,53 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vincent TRUMPFF");
 MODULE_DESCRIPTION("Driver for AC zero crossing detector");
 
-module_param(ac_zc_gpio, int, 0444);
-MODULE_PARM_DESC(ac_zc_gpio, "Zero crossing detector GPIO number");
+module_param_array(ac_zc_gpio, int, &ac_zc_gpio_count, 0444);
+MODULE_PARM_DESC(ac_zc_gpio, "Zero crossing detector GPIO numbers, one per mains phase");
+module_param(ac_zc_pulse, int, 0444);
+MODULE_PARM_DESC(ac_zc_pulse, "Detector outputs a pulse centered on each crossing (else a level following mains polarity)");
+module_param(ac_zc_min_interval, uint, 0644);
+MODULE_PARM_DESC(ac_zc_min_interval, "Reject edges closer than this percentage of the tracked spacing (0 = disabled)");
+module_param(ac_zc_virtual_freq, uint, 0644);
+MODULE_PARM_DESC(ac_zc_virtual_freq, "Add a virtual detector generating crossings at this mains frequency (mHz, 0 = none)");
+module_param(ac_zc_virtual_jitter, uint, 0644);
+MODULE_PARM_DESC(ac_zc_virtual_jitter, "Virtual detector random edge jitter (+/- ns)");
+module_param(ac_zc_virtual_drift, int, 0644);
+MODULE_PARM_DESC(ac_zc_virtual_drift, "Virtual detector frequency offset (ppm)");
+module_param(ac_zc_virtual_drop, uint, 0644);
+MODULE_PARM_DESC(ac_zc_virtual_drop, "Virtual detector dropped edges (per mille)");
+module_param(ac_zc_virtual_width, uint, 0644);
+MODULE_PARM_DESC(ac_zc_virtual_width, "Virtual detector pulse width, pulse mode only (ns)");
+module_param(ac_zc_replay, int, 0444);
+MODULE_PARM_DESC(ac_zc_replay, "Add a detector replaying edges written to /dev/ac_zc_trace");
+module_param(ac_zc_replay_zc, uint, 0644);
+MODULE_PARM_DESC(ac_zc_replay_zc, "Recorded detector replayed, records of other ones are skipped");
 
+EXPORT_SYMBOL(ac_zc_count);
 EXPORT_SYMBOL(ac_zc_register);
 EXPORT_SYMBOL(ac_zc_unregister);
 EXPORT_SYMBOL(ac_zc_freq);
+EXPORT_SYMBOL(ac_zc_period);
+EXPORT_SYMBOL(ac_zc_crossing);
+EXPORT_SYMBOL(ac_zc_pulse_width);
 
 module_init(ac_zc_init);
 module_exit(ac_zc_exit);
 
+int ac_zc_count(void)
+{
+	return ac_zc_detector_count;
+}
+
 // return : id > 0 on success (to unregister), error < 0 on failure
-int ac_zc_register(int status, ac_zc_callback cb, void *cb_data)
+int ac_zc_register(unsigned int zc, int status, ac_zc_callback cb, void *cb_data)
 {
 	int ret;
 	unsigned int index;
 	struct ac_zc_cb_desc *desc;
 
-	if(status <= 0 || status > (AC_ZC_STATUS_ENTER | AC_ZC_STATUS_LEAVE))
+	if(zc >= ac_zc_detector_count)
+		return -EINVAL;
+	if(status <= 0 || status > (AC_ZC_STATUS_ENTER | AC_ZC_STATUS_LEAVE | AC_ZC_STATUS_CROSSING))
 		return -EINVAL;
 	if(!cb)
 		return -EINVAL;
@@ -86,7 +283,7 @@ int ac_zc_register(int status, ac_zc_callback cb, void *cb_data)
 	ret = -EBUSY; // no empty place in array
 	for(index = 0; index < ZC_DESCRIPTOR_SIZE; ++index)
 	{
-		desc = zc_descriptors + index;
+		desc = ac_zc_detectors[zc].descriptors + index;
 		if(desc->status)
 			continue;
 
@@ -103,30 +300,121 @@ int ac_zc_register(int status, ac_zc_callback cb, void *cb_data)
 	return ret;
 }
 
-int ac_zc_unregister(int id)
+int ac_zc_unregister(unsigned int zc, int id)
 {
+	if(zc >= ac_zc_detector_count)
+		return -EINVAL;
 	if(id <= 0 || id > ZC_DESCRIPTOR_SIZE)
 		return -EINVAL;
 
 	mutex_lock(&ac_zc_descriptors_lock);
 
-	zc_descriptors[id-1].status = 0;
+	ac_zc_detectors[zc].descriptors[id-1].status = 0;
 
 	mutex_unlock(&ac_zc_descriptors_lock);
 
 	return 0;
 }
 
-int ac_zc_freq(void)
+int ac_zc_freq(unsigned int zc)
+{
+	if(zc >= ac_zc_detector_count)
+		return 0;
+	return ac_zc_detectors[zc].freq_value;
+}
+
+u32 ac_zc_period(unsigned int zc)
+{
+	if(zc >= ac_zc_detector_count)
+		return 0;
+	return ac_zc_detectors[zc].period;
+}
+
+ktime_t ac_zc_crossing(unsigned int zc)
+{
+	if(zc >= ac_zc_detector_count)
+		return ktime_set(0,0);
+	return ac_zc_detectors[zc].crossing;
+}
+
+u32 ac_zc_pulse_width(unsigned int zc)
+{
+	if(zc >= ac_zc_detector_count)
+		return 0;
+	return ac_zc_detectors[zc].width;
+}
+
+static void ac_zc_track(u32 *value, s64 sample)
 {
-	return ac_zc_freq_value;
+	if(*value == 0)
+		*value = sample;
+	else
+		*value += ((s32)sample - (s32)*value) >> AC_ZC_TRACK_SHIFT;
 }
 
-// Sysfs definitions for ac_zc class
+/* Sysfs attributes definition for detectors */
+static DEVICE_ATTR(gpio,        0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(freq,        0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(period,      0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(offset,      0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(pulse_width, 0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(crossing,    0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(rejected,    0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(missing,     0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(extra,       0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(stats_1s,    0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(stats_1min,  0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(stats_15min, 0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(dispatch_max, 0644, ac_zc_dev_show, ac_zc_dev_store);
+static DEVICE_ATTR(dispatch_avg, 0444, ac_zc_dev_show, NULL);
+static DEVICE_ATTR(cpu,         0644, ac_zc_dev_show, ac_zc_dev_store);
+static DEVICE_ATTR(effective_cpu, 0444, ac_zc_dev_show, NULL);
+
+static const struct attribute *ac_zc_dev_attrs[] =
+{
+	&dev_attr_gpio.attr,
+	&dev_attr_freq.attr,
+	&dev_attr_period.attr,
+	&dev_attr_offset.attr,
+	&dev_attr_pulse_width.attr,
+	&dev_attr_crossing.attr,
+	&dev_attr_rejected.attr,
+	&dev_attr_missing.attr,
+	&dev_attr_extra.attr,
+	&dev_attr_stats_1s.attr,
+	&dev_attr_stats_1min.attr,
+	&dev_attr_stats_15min.attr,
+	&dev_attr_dispatch_max.attr,
+	&dev_attr_dispatch_avg.attr,
+	&dev_attr_cpu.attr,
+	&dev_attr_effective_cpu.attr,
+	NULL,
+};
+
+static const struct attribute_group ac_zc_dev_attr_group =
+{
+	.attrs = (struct attribute **) ac_zc_dev_attrs,
+};
+
+// Sysfs definitions for ac_zc class, attributes show the first detector
 static struct class_attribute ac_zc_class_attrs[] =
 {
 	__ATTR(gpio, 0444, ac_zc_attr_show, NULL),
 	__ATTR(freq, 0444, ac_zc_attr_show, NULL),
+	__ATTR(period, 0444, ac_zc_attr_show, NULL),
+	__ATTR(offset, 0444, ac_zc_attr_show, NULL),
+	__ATTR(pulse_width, 0444, ac_zc_attr_show, NULL),
+	__ATTR(crossing, 0444, ac_zc_attr_show, NULL),
+	__ATTR(rejected, 0444, ac_zc_attr_show, NULL),
+	__ATTR(missing, 0444, ac_zc_attr_show, NULL),
+	__ATTR(extra, 0444, ac_zc_attr_show, NULL),
+	__ATTR(stats_1s, 0444, ac_zc_attr_show, NULL),
+	__ATTR(stats_1min, 0444, ac_zc_attr_show, NULL),
+	__ATTR(stats_15min, 0444, ac_zc_attr_show, NULL),
+	__ATTR(dispatch_max, 0644, ac_zc_attr_show, ac_zc_attr_store),
+	__ATTR(dispatch_avg, 0444, ac_zc_attr_show, NULL),
+	__ATTR(cpu, 0644, ac_zc_attr_show, ac_zc_attr_store),
+	__ATTR(effective_cpu, 0444, ac_zc_attr_show, NULL),
 	__ATTR_NULL,
 };
 
@@ -138,112 +426,911 @@ static struct class ac_zc_class =
 };
 
 // Show attributes values for zero crossing detector
-ssize_t ac_zc_attr_show(struct class *class, struct class_attribute *attr, char *buf)
+ssize_t ac_zc_show(struct ac_zc_detector *detector, const char *name, char *buf)
 {
 	ssize_t status;
+	unsigned int index;
+	u32 freq;
 
-	if(strcmp(attr->attr.name, "gpio") == 0)
-		status = sprintf(buf, "%d\n", ac_zc_gpio);
-	else if(strcmp(attr->attr.name, "freq") == 0)
-		status = sprintf(buf, "%d Hz\n", (ac_zc_freq_start == get_now_secs()) ? ac_zc_freq_value : 0);
+	for(index = 0; index < AC_ZC_WINDOW_COUNT; ++index)
+	{
+		if(strcmp(name, ac_zc_window_names[index]) == 0)
+			return ac_zc_window_show(detector, index, buf);
+	}
+
+	if(strcmp(name, "gpio") == 0)
+		status = sprintf(buf, "%d\n", detector->gpio);
+	else if(strcmp(name, "freq") == 0)
+	{
+		// from the smoothed period, 0 once crossings stopped for a second
+		freq = 0;
+		if(detector->period && ktime_to_ns(ktime_sub(ktime_get(), detector->last_enter)) < NSEC_PER_SEC)
+			freq = div_u64(1000000000000ULL, detector->period);
+		status = sprintf(buf, "%u.%03u Hz\n", freq / 1000, freq % 1000);
+	}
+	else if(strcmp(name, "period") == 0)
+		status = sprintf(buf, "%u ns\n", detector->period);
+	else if(strcmp(name, "offset") == 0)
+		status = sprintf(buf, "%d ns\n", ac_zc_edge_offset(detector));
+	else if(strcmp(name, "pulse_width") == 0)
+		status = sprintf(buf, "%u ns\n", detector->width);
+	else if(strcmp(name, "crossing") == 0)
+		status = sprintf(buf, "%lld ns\n", ktime_to_ns(detector->crossing));
+	else if(strcmp(name, "rejected") == 0)
+		status = sprintf(buf, "%u\n", detector->rejected);
+	else if(strcmp(name, "missing") == 0)
+		status = sprintf(buf, "%u\n", detector->missing);
+	else if(strcmp(name, "extra") == 0)
+		status = sprintf(buf, "%u\n", detector->extra);
+	else if(strcmp(name, "dispatch_max") == 0)
+		status = sprintf(buf, "%u ns\n", detector->dispatch_max);
+	else if(strcmp(name, "dispatch_avg") == 0)
+		status = sprintf(buf, "%llu ns\n", detector->dispatch_count ? div_u64(detector->dispatch_total, detector->dispatch_count) : 0);
+	else if(strcmp(name, "cpu") == 0)
+		status = sprintf(buf, "%d\n", detector->cpu);
+	else if(strcmp(name, "effective_cpu") == 0)
+		status = sprintf(buf, "%d\n", detector->last_cpu);
 	else
 		status = -EIO;
 
 	return status;
 }
 
+/* Store attributes values for zero crossing detector.
+ * cpu : pin the detector IRQ to a CPU (-1 for any), so that mains
+ * timing can have an isolated core. Only GPIO detectors have an IRQ.
+ * dispatch_max : 0 resets the dispatch statistics, eg between benchmark
+ * runs. The edge handler does it, so that it never sees them half reset.
+ */
+ssize_t ac_zc_store(struct ac_zc_detector *detector, const char *name, const char *buf, size_t len)
+{
+	int status;
+	int cpu;
+	unsigned int value;
+
+	if(strcmp(name, "dispatch_max") == 0)
+	{
+		status = kstrtouint(buf, 0, &value);
+		if(status < 0)
+			return status;
+		if(value != 0)
+			return -EINVAL;
+
+		WRITE_ONCE(detector->dispatch_reset, 1);
+		return len;
+	}
+
+	if(strcmp(name, "cpu") != 0)
+		return -EIO;
+
+	status = ac_parse_cpu(buf, &cpu);
+	if(status < 0)
+		return status;
+
+	if(detector->source != AC_ZC_SOURCE_GPIO)
+		return -EOPNOTSUPP;
+
+	// a NULL hint only drops the hint, affinity is restored to all CPUs first
+	status = irq_set_affinity_hint(detector->irq, cpu < 0 ? cpu_online_mask : cpumask_of(cpu));
+	if(status == 0 && cpu < 0)
+		status = irq_set_affinity_hint(detector->irq, NULL);
+	if(status < 0)
+		return status;
+
+	detector->cpu = cpu;
+	return len;
+}
+
+/* Show the last completed window of mains period statistics,
+ * nothing is counted once crossings stopped for a window.
+ */
+ssize_t ac_zc_window_show(struct ac_zc_detector *detector, unsigned int index, char *buf)
+{
+	struct ac_zc_window *window = &detector->windows[index];
+	struct ac_zc_window_result result;
+	ktime_t start;
+	u32 seq;
+
+	do
+	{
+		seq = READ_ONCE(detector->stats_seq);
+		smp_rmb();
+		result = window->result;
+		start = window->start;
+		smp_rmb();
+	} while((seq & 1) || seq != READ_ONCE(detector->stats_seq));
+
+	if(ktime_to_ns(ktime_sub(ktime_get(), start)) >= 2 * ac_zc_window_ns[index])
+		memset(&result, 0, sizeof(result));
+
+	return sprintf(buf, "count %u min %u max %u mean %u variance %llu\n",
+		result.count, result.min, result.max, result.mean, result.variance);
+}
+
+ssize_t ac_zc_attr_store(struct class *class, struct class_attribute *attr, const char *buf, size_t len)
+{
+	return ac_zc_store(&ac_zc_detectors[0], attr->attr.name, buf, len);
+}
+
+ssize_t ac_zc_dev_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len)
+{
+	return ac_zc_store(dev_get_drvdata(dev), attr->attr.name, buf, len);
+}
+
+ssize_t ac_zc_attr_show(struct class *class, struct class_attribute *attr, char *buf)
+{
+	return ac_zc_show(&ac_zc_detectors[0], attr->attr.name, buf);
+}
+
+ssize_t ac_zc_dev_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return ac_zc_show(dev_get_drvdata(dev), attr->attr.name, buf);
+}
+
+/* Phase correction of the enter edge, in ns (crossing = enter - offset).
+ * A level detector switching at a threshold above zero rises late and
+ * falls early by the same amount, which shortens the high level by twice
+ * that amount compared to a half period.
+ * A pulse detector rises half a pulse before the crossing.
+ */
+static s32 ac_zc_edge_offset(struct ac_zc_detector *detector)
+{
+	if(ac_zc_pulse)
+		return -(s32)(detector->width / 2);
+	if(detector->period == 0 || detector->width == 0)
+		return 0;
+	return ((s32)(detector->period >> 1) - (s32)detector->width) / 2;
+}
+
+/* Glitch filter: an edge is accepted only if the previous accepted
+ * edge is far enough, relatively to the tracked spacing between them.
+ * Accepted edges alternate, so the previous one is of the other kind :
+ * a half period for a level detector, the pulse width before a leave
+ * and the rest of the half period before an enter for a pulse detector.
+ * A rejected edge leaves the logical level unchanged, so the edge that
+ * ends the glitch is ignored as well.
+ */
+static int ac_zc_edge_rejected(struct ac_zc_detector *detector, int gpio_value, ktime_t now)
+{
+	ktime_t last = gpio_value ? detector->last_leave : detector->last_enter;
+	u32 half = detector->period >> 1;
+	u32 spacing;
+
+	if(!ac_zc_pulse)
+		spacing = half;
+	else if(!gpio_value)
+		spacing = detector->width;
+	else
+		spacing = half > detector->width ? half - detector->width : 0;
+
+	if(ac_zc_min_interval == 0 || spacing == 0 || last.tv64 == 0)
+		return 0;
+
+	return ktime_to_ns(ktime_sub(now, last)) < (s64)(spacing / 100 * ac_zc_min_interval);
+}
+
 irqreturn_t ac_zc_irq_handler(int irq, void *dev_id)
+{
+	struct ac_zc_detector *detector = dev_id;
+	ktime_t now;
+
+	if(detector < &ac_zc_detectors[0])
+		return IRQ_NONE;
+	if(detector >= &ac_zc_detectors[ac_zc_detector_count])
+		return IRQ_NONE;
+	if(irq != detector->irq)
+		return IRQ_NONE;
+
+	now = ktime_get();
+
+	ac_zc_edge(detector, gpiod_get_raw_value(detector->gpiod), now);
+
+	return IRQ_HANDLED;
+}
+
+/* Half period of the virtual detector in ns, from its frequency and drift */
+static s64 ac_zc_virtual_half_period(void)
+{
+	s64 period;
+
+	if(ac_zc_virtual_freq == 0)
+		return 0;
+
+	period = div_u64(1000000000000ULL, ac_zc_virtual_freq);
+	period -= div_s64(period * ac_zc_virtual_drift, 1000000);
+	return period >> 1;
+}
+
+/* The virtual detector timer fires at each edge a real detector
+ * would produce, and feeds it to the same path as the GPIO interrupt.
+ */
+enum hrtimer_restart ac_zc_virtual_callback(struct hrtimer *timer)
+{
+	struct ac_zc_detector *detector = container_of(timer, struct ac_zc_detector, timer);
+	s64 half = ac_zc_virtual_half_period();
+	s64 next;
+	int value = detector->virtual_value;
+
+	// stopped at runtime : poll for restart
+	if(half == 0)
+	{
+		hrtimer_forward_now(timer, ktime_set(0, 100000000));
+		return HRTIMER_RESTART;
+	}
+
+	if(ac_zc_virtual_drop == 0 || prandom_u32() % 1000 >= ac_zc_virtual_drop)
+		ac_zc_edge(detector, value, ktime_get());
+
+	detector->virtual_value = !value;
+
+	// level : one edge per crossing, pulse : around each crossing
+	if(!ac_zc_pulse)
+	{
+		detector->virtual_crossing = ktime_add_ns(detector->virtual_crossing, half);
+		next = ktime_to_ns(detector->virtual_crossing);
+	}
+	else if(value)
+	{
+		next = ktime_to_ns(detector->virtual_crossing) + ac_zc_virtual_width / 2;
+	}
+	else
+	{
+		detector->virtual_crossing = ktime_add_ns(detector->virtual_crossing, half);
+		next = ktime_to_ns(detector->virtual_crossing) - ac_zc_virtual_width / 2;
+	}
+
+	if(ac_zc_virtual_jitter)
+		next += (s64)(prandom_u32() % (2 * ac_zc_virtual_jitter + 1)) - ac_zc_virtual_jitter;
+
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
+/* Replay detector timer fires at each queued record time, shifted so
+ * that the first record of a replay happens right after it is written.
+ * Edges are handled at their scheduled time rather than at the time the
+ * timer actually fires, so that a replay is deterministic.
+ */
+enum hrtimer_restart ac_zc_replay_callback(struct hrtimer *timer)
+{
+	struct ac_zc_detector *detector = container_of(timer, struct ac_zc_detector, timer);
+	struct ac_zc_trace_record record;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+	raw_spin_lock(&ac_zc_capture_lock);
+
+	if(kfifo_get(&ac_zc_replay_fifo, &record))
+	{
+		raw_spin_unlock(&ac_zc_capture_lock);
+		ac_zc_edge(detector, record.value, ns_to_ktime(record.time + detector->replay_offset));
+		raw_spin_lock(&ac_zc_capture_lock);
+	}
+
+	if(kfifo_peek(&ac_zc_replay_fifo, &record))
+	{
+		hrtimer_set_expires(timer, ns_to_ktime(record.time + detector->replay_offset));
+		ret = HRTIMER_RESTART;
+	}
+	else
+	{
+		// next write starts a new replay
+		detector->replay_offset = 0;
+	}
+
+	raw_spin_unlock(&ac_zc_capture_lock);
+
+	irq_work_queue(&ac_zc_trace_wake);
+	return ret;
+}
+
+/* Queue a raw edge for the trace device reader */
+static void ac_zc_capture_edge(struct ac_zc_detector *detector, int gpio_value, ktime_t now)
+{
+	struct ac_zc_trace_record record;
+
+	record.time = ktime_to_ns(now);
+	record.zc = detector->index;
+	record.value = gpio_value;
+
+	raw_spin_lock(&ac_zc_capture_lock);
+	if(!kfifo_put(&ac_zc_capture, record))
+		++ac_zc_capture_overrun;
+	raw_spin_unlock(&ac_zc_capture_lock);
+
+	irq_work_queue(&ac_zc_trace_wake);
+}
+
+/* Wake up trace device readers and writers, out of hard interrupt context */
+static void ac_zc_trace_wake_up(struct irq_work *work)
+{
+	wake_up_interruptible(&ac_zc_capture_wait);
+	wake_up_interruptible(&ac_zc_replay_wait);
+}
+
+/* Handle a detector edge, from its GPIO interrupt or from its generator */
+void ac_zc_edge(struct ac_zc_detector *detector, int gpio_value, ktime_t now)
 {
 	s64 now_secs;
-	int gpio_value;
+	s64 interval;
+	u32 elapsed;
 	struct ac_zc_cb_desc *desc;
 	int index;
 	int status;
 
-	if(irq != ac_zc_irq)
-		return IRQ_NONE;
-	if(dev_id != &ac_zc_class)
-		return IRQ_NONE;
+	detector->last_cpu = smp_processor_id();
 
-	gpio_value = gpio_get_value(ac_zc_gpio);
-	if(gpio_value == ac_zc_gpio_previous_value)
-		return IRQ_HANDLED;
-	ac_zc_gpio_previous_value = gpio_value;
+	if(test_bit(FLAG_CAPTURE, &ac_zc_trace_flags))
+		ac_zc_capture_edge(detector, gpio_value, now);
+
+	if(gpio_value == detector->gpio_previous_value)
+		return;
+	if(ac_zc_edge_rejected(detector, gpio_value, now))
+	{
+		++detector->rejected;
+		return;
+	}
+	detector->gpio_previous_value = gpio_value;
+
+	// period and width, updated before callbacks so that they see the current values
+	if(gpio_value)
+	{
+		if(detector->last_enter.tv64)
+		{
+			// pulses are one half period apart
+			interval = ktime_to_ns(ktime_sub(now, detector->last_enter));
+			if(interval > 0 && interval < NSEC_PER_SEC && ac_zc_quality(detector, interval, now))
+				ac_zc_track(&detector->period, ac_zc_pulse ? interval * 2 : interval);
+		}
+		detector->last_enter = now;
+	}
+	else
+	{
+		if(detector->last_enter.tv64)
+		{
+			// not from an enter edge kept out of the period
+			interval = ktime_to_ns(ktime_sub(now, detector->last_enter));
+			if(interval > 0 && interval < NSEC_PER_SEC && (detector->outliers == 0 || detector->outliers >= AC_ZC_RESYNC))
+				ac_zc_track(&detector->width, interval);
+		}
+		detector->last_leave = now;
+	}
+
+	if(ac_zc_pulse)
+	{
+		// the crossing is the middle of the pulse, known once it ends
+		if(gpio_value)
+		{
+			status = AC_ZC_STATUS_ENTER;
+		}
+		else if(detector->last_enter.tv64)
+		{
+			status = AC_ZC_STATUS_LEAVE | AC_ZC_STATUS_CROSSING;
+			detector->crossing = ktime_add_ns(detector->last_enter, ktime_to_ns(ktime_sub(now, detector->last_enter)) >> 1);
+		}
+		else
+		{
+			status = AC_ZC_STATUS_LEAVE;
+		}
+	}
+	// each edge of a level detector is a crossing of the mains
+	else if(gpio_value)
+	{
+		status = AC_ZC_STATUS_ENTER | AC_ZC_STATUS_CROSSING;
+		detector->crossing = ktime_sub(now, ns_to_ktime(ac_zc_edge_offset(detector)));
+	}
+	else
+	{
+		status = AC_ZC_STATUS_LEAVE | AC_ZC_STATUS_CROSSING;
+		detector->crossing = ktime_add(now, ns_to_ktime(ac_zc_edge_offset(detector)));
+	}
 
 	//callbacks
-	status = gpio_value ? AC_ZC_STATUS_ENTER : AC_ZC_STATUS_LEAVE;
 	for(index=0; index<ZC_DESCRIPTOR_SIZE; ++index)
 	{
-		desc = zc_descriptors + index;
+		desc = detector->descriptors + index;
 		if(desc->status & status)
-			desc->cb(status, desc->cb_data);
+			desc->cb(status & desc->status, desc->cb_data);
 	}
 
+	if(status & AC_ZC_STATUS_CROSSING)
+		ac_zc_status_update(detector);
+
 	// stats
+	if(READ_ONCE(detector->dispatch_reset))
+	{
+		detector->dispatch_max = 0;
+		detector->dispatch_total = 0;
+		detector->dispatch_count = 0;
+		WRITE_ONCE(detector->dispatch_reset, 0);
+	}
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), now));
+	if(elapsed > detector->dispatch_max)
+		detector->dispatch_max = elapsed;
+	detector->dispatch_total += elapsed;
+	++detector->dispatch_count;
+
 	if(!gpio_value)
-		return IRQ_HANDLED;
+		return;
 
-	now_secs = get_now_secs();
-	if(now_secs != ac_zc_freq_start)
+	now_secs = get_ktime_secs(now);
+	if(now_secs != detector->freq_start)
 	{
-		ac_zc_freq_value = ac_zc_freq_counter;
-		ac_zc_freq_counter = 0;
-		ac_zc_freq_start = now_secs;
+		detector->freq_value = ac_zc_pulse ? detector->freq_counter / 2 : detector->freq_counter;
+		detector->freq_counter = 0;
+		detector->freq_start = now_secs;
 	}
-	++ac_zc_freq_counter;
+	++detector->freq_counter;
+}
 
-	return IRQ_HANDLED;
+/* Mains quality from the interval between enter edges, before it is
+ * tracked. Intervals off by more than a quarter of the expected one
+ * are counted as extra edges when shorter, as missing ones when longer:
+ * at least one, then the nearest count of spacings the gap spans. They
+ * are kept out of the period statistics and of the period and width
+ * tracking, unless they persist (see AC_ZC_RESYNC).
+ * Only called from the detector edges.
+ * return : 1 if the interval is to be tracked
+ */
+int ac_zc_quality(struct ac_zc_detector *detector, s64 interval, ktime_t now)
+{
+	u32 spacing = ac_zc_pulse ? detector->period >> 1 : detector->period;
+	u32 sample = ac_zc_pulse ? interval * 2 : interval;
+	unsigned int index;
+	unsigned int missing;
+
+	if(spacing == 0)
+		return 1;
+
+	if(interval < spacing - (spacing >> 2) || interval > spacing + (spacing >> 2))
+	{
+		if(interval < spacing)
+			++detector->extra;
+		else
+		{
+			// rare, the division is fine
+			missing = div_u64(interval + (spacing >> 1), spacing) - 1;
+			detector->missing += max(missing, 1U);
+		}
+
+		if(detector->outliers < AC_ZC_RESYNC)
+			++detector->outliers;
+		return detector->outliers >= AC_ZC_RESYNC;
+	}
+
+	detector->outliers = 0;
+
+	ac_status_write_begin(&detector->stats_seq);
+	for(index = 0; index < AC_ZC_WINDOW_COUNT; ++index)
+		ac_zc_window_add(&detector->windows[index], ac_zc_window_ns[index], sample, now);
+	ac_status_write_end(&detector->stats_seq);
+	return 1;
 }
 
-int __init ac_zc_init(void)
+/* Add a period sample to a window, divisions only happen when it ends */
+void ac_zc_window_add(struct ac_zc_window *window, s64 duration, u32 sample, ktime_t now)
+{
+	struct ac_zc_window_result *result = &window->result;
+	s64 mean;
+	s64 delta;
+
+	if(window->count && ktime_to_ns(ktime_sub(now, window->start)) >= duration)
+	{
+		mean = div_s64(window->sum, window->count);
+		result->count = window->count;
+		result->min = window->min;
+		result->max = window->max;
+		result->mean = window->ref + mean;
+		result->variance = div_u64(window->sumsq, window->count) - mean * mean;
+		window->count = 0;
+	}
+
+	if(window->count == 0)
+	{
+		window->start = now;
+		window->min = window->max = window->ref = sample;
+		window->sum = 0;
+		window->sumsq = 0;
+	}
+
+	delta = (s64)sample - window->ref;
+	++window->count;
+	window->min = min(window->min, sample);
+	window->max = max(window->max, sample);
+	window->sum += delta;
+	window->sumsq += delta * delta;
+}
+
+/* Publish a detector to the status page, only called from its own edges */
+void ac_zc_status_update(struct ac_zc_detector *detector)
+{
+	struct ac_zc_status_detector *entry = &ac_zc_status_page->detectors[detector->index];
+
+	ac_status_write_begin(&entry->seq);
+	entry->period = detector->period;
+	entry->crossing = ktime_to_ns(detector->crossing);
+	entry->freq = detector->freq_value;
+	entry->rejected = detector->rejected;
+	ac_status_write_end(&entry->seq);
+}
+
+static int ac_zc_status_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return ac_status_mmap(vma, ac_zc_status_page);
+}
+
+static const struct file_operations ac_zc_status_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = nonseekable_open,
+	.mmap    = ac_zc_status_mmap,
+	.llseek  = no_llseek,
+};
+
+static struct miscdevice ac_zc_status_device =
+{
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "ac_zc_status",
+	.fops  = &ac_zc_status_fops,
+};
+
+static int ac_zc_trace_open(struct inode *inode, struct file *file)
 {
+	unsigned long flags;
+
+	if(file->f_mode & FMODE_READ)
+	{
+		// single capture reader, edges may already be queued as soon as the flag is set
+		if(test_and_set_bit(FLAG_CAPTURE, &ac_zc_trace_flags))
+			return -EBUSY;
+		raw_spin_lock_irqsave(&ac_zc_capture_lock, flags);
+		kfifo_reset(&ac_zc_capture);
+		ac_zc_capture_overrun = 0;
+		raw_spin_unlock_irqrestore(&ac_zc_capture_lock, flags);
+	}
+
+	if((file->f_mode & FMODE_WRITE) && !ac_zc_replay_detector)
+	{
+		if(file->f_mode & FMODE_READ)
+			clear_bit(FLAG_CAPTURE, &ac_zc_trace_flags);
+		return -ENODEV;
+	}
+
+	return nonseekable_open(inode, file);
+}
+
+static int ac_zc_trace_release(struct inode *inode, struct file *file)
+{
+	if(file->f_mode & FMODE_READ)
+	{
+		clear_bit(FLAG_CAPTURE, &ac_zc_trace_flags);
+		if(ac_zc_capture_overrun)
+			printk(KERN_INFO "zc trace : %u edges lost during capture\n", ac_zc_capture_overrun);
+	}
+	return 0;
+}
+
+static ssize_t ac_zc_trace_read(struct file *file, char __user *buf, size_t len, loff_t *ppos)
+{
+	unsigned int copied;
 	int status;
-	printk(KERN_INFO "AC zc v0.1 initializing.\n");
 
-	ac_zc_gpio_previous_value = 0;
-	ac_zc_freq_start = get_now_secs();
+	if(len < sizeof(struct ac_zc_trace_record))
+		return -EINVAL;
 
-	status = class_register(&ac_zc_class);
+	while(kfifo_is_empty(&ac_zc_capture))
+	{
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		status = wait_event_interruptible(ac_zc_capture_wait, !kfifo_is_empty(&ac_zc_capture));
+		if(status)
+			return status;
+	}
+
+	// single reader : no lock needed against writers
+	status = kfifo_to_user(&ac_zc_capture, buf, len, &copied);
+	return status ? : copied;
+}
+
+static ssize_t ac_zc_trace_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	struct ac_zc_detector *detector = ac_zc_replay_detector;
+	struct ac_zc_trace_record record;
+	unsigned long flags;
+	size_t done;
+	int status = 0;
+
+	if(len % sizeof(record))
+		return -EINVAL;
+
+	mutex_lock(&ac_zc_replay_lock);
+
+	for(done = 0; done < len; done += sizeof(record))
+	{
+		if(copy_from_user(&record, buf + done, sizeof(record)))
+		{
+			status = -EFAULT;
+			break;
+		}
+
+		if(record.zc != READ_ONCE(ac_zc_replay_zc))
+			continue;
+
+		while(kfifo_is_full(&ac_zc_replay_fifo))
+		{
+			status = -EAGAIN;
+			if(file->f_flags & O_NONBLOCK)
+				break;
+			status = wait_event_interruptible(ac_zc_replay_wait, !kfifo_is_full(&ac_zc_replay_fifo));
+			if(status)
+				break;
+		}
+		if(status)
+			break;
+
+		raw_spin_lock_irqsave(&ac_zc_capture_lock, flags);
+		kfifo_put(&ac_zc_replay_fifo, record);
+		if(detector->replay_offset == 0)
+		{
+			// replay idle : start it
+			detector->replay_offset = ktime_to_ns(ktime_add_ns(ktime_get(), NSEC_PER_MSEC)) - record.time;
+			hrtimer_start(&detector->timer, ns_to_ktime(record.time + detector->replay_offset), HRTIMER_MODE_ABS);
+		}
+		raw_spin_unlock_irqrestore(&ac_zc_capture_lock, flags);
+	}
+
+	mutex_unlock(&ac_zc_replay_lock);
+
+	return done ? done : status;
+}
+
+static unsigned int ac_zc_trace_poll(struct file *file, poll_table *wait)
+{
+	unsigned int mask = 0;
+
+	poll_wait(file, &ac_zc_capture_wait, wait);
+	poll_wait(file, &ac_zc_replay_wait, wait);
+
+	if((file->f_mode & FMODE_READ) && !kfifo_is_empty(&ac_zc_capture))
+		mask |= POLLIN | POLLRDNORM;
+	if((file->f_mode & FMODE_WRITE) && !kfifo_is_full(&ac_zc_replay_fifo))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
+
+static const struct file_operations ac_zc_trace_fops =
+{
+	.owner   = THIS_MODULE,
+	.open    = ac_zc_trace_open,
+	.release = ac_zc_trace_release,
+	.read    = ac_zc_trace_read,
+	.write   = ac_zc_trace_write,
+	.poll    = ac_zc_trace_poll,
+	.llseek  = no_llseek,
+};
+
+static struct miscdevice ac_zc_trace_device =
+{
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "ac_zc_trace",
+	.fops  = &ac_zc_trace_fops,
+};
+
+/* Create the sysfs device of a detector */
+static int ac_zc_detector_create_device(struct ac_zc_detector *detector)
+{
+	struct device *dev;
+	int status;
+
+	detector->dev = dev = device_create(&ac_zc_class, NULL, MKDEV(0, 0), detector, "zc%u", detector->index);
+	if(!dev)
+		return -ENODEV;
+
+	status = sysfs_create_group(&dev->kobj, &ac_zc_dev_attr_group);
 	if(status < 0)
-		goto fail_safe;
+		device_unregister(dev);
+
+	return status;
+}
+
+/* Start the generator of a virtual detector and create its sysfs device */
+static int ac_zc_virtual_setup(struct ac_zc_detector *detector)
+{
+	int status;
+
+	status = ac_zc_detector_create_device(detector);
+	if(status < 0)
+		return status;
+
+	detector->virtual_value = 1;
+	detector->virtual_crossing = ktime_add_ns(ktime_get(), NSEC_PER_MSEC);
+	ac_hrtimer_init(&detector->timer, HRTIMER_MODE_ABS);
+	detector->timer.function = &ac_zc_virtual_callback;
+	hrtimer_start(&detector->timer, detector->virtual_crossing, HRTIMER_MODE_ABS);
+
+	printk(KERN_INFO "zc%u virtual, %u mHz, %s detector\n", detector->index, ac_zc_virtual_freq, ac_zc_pulse ? "pulse" : "level");
+	return 0;
+}
+
+/* Prepare the timer of a replay detector and create its sysfs device */
+static int ac_zc_replay_setup(struct ac_zc_detector *detector)
+{
+	int status;
+
+	status = ac_zc_detector_create_device(detector);
+	if(status < 0)
+		return status;
+
+	detector->replay_offset = 0;
+	ac_hrtimer_init(&detector->timer, HRTIMER_MODE_ABS);
+	detector->timer.function = &ac_zc_replay_callback;
+	ac_zc_replay_detector = detector;
+
+	printk(KERN_INFO "zc%u replay, %s detector\n", detector->index, ac_zc_pulse ? "pulse" : "level");
+	return 0;
+}
+
+/* Claim the GPIO of a detector, its IRQ and create its sysfs device */
+static int ac_zc_detector_setup(struct ac_zc_detector *detector)
+{
+	int status;
+
+	if(detector->source == AC_ZC_SOURCE_VIRTUAL)
+		return ac_zc_virtual_setup(detector);
+	if(detector->source == AC_ZC_SOURCE_REPLAY)
+		return ac_zc_replay_setup(detector);
 
 	status = -EINVAL;
-	if(!gpio_is_valid(ac_zc_gpio))
-		goto fail_after_class;
+	if(!gpio_is_valid(detector->gpio))
+		goto fail_safe;
 
-	status = gpio_request(ac_zc_gpio, "ac_zc_gpio");
+	status = gpio_request(detector->gpio, "ac_zc_gpio");
 	if(status < 0)
-		goto fail_after_class;
+		goto fail_safe;
 
-	status = gpio_direction_input(ac_zc_gpio);
+	detector->gpiod = gpio_to_desc(detector->gpio);
+
+	status = gpiod_direction_input(detector->gpiod);
 	if(status < 0)
 		goto fail_after_gpio;
 
-	ac_zc_irq = status = gpio_to_irq(ac_zc_gpio);
+	detector->irq = status = gpiod_to_irq(detector->gpiod);
 	if(status < 0)
 		goto fail_after_gpio;
 
-	status = request_irq(ac_zc_irq, ac_zc_irq_handler, IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING | IRQF_SHARED | IRQF_NO_THREAD, "ac_zc_gpio_irq", &ac_zc_class);
+	status = request_irq(detector->irq, ac_zc_irq_handler, IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING | IRQF_SHARED | IRQF_NO_THREAD, "ac_zc_gpio_irq", detector);
 	if(status < 0)
 		goto fail_after_gpio;
 
-	printk(KERN_INFO "zc GPIO : %d, IRQ : %d\n", ac_zc_gpio, ac_zc_irq);
-	printk(KERN_INFO "AC zc initialized.\n");
+	status = ac_zc_detector_create_device(detector);
+	if(status < 0)
+		goto fail_after_irq;
+
+	printk(KERN_INFO "zc%u GPIO : %d, IRQ : %d, %s detector\n", detector->index, detector->gpio, detector->irq, ac_zc_pulse ? "pulse" : "level");
 	return 0;
 
+fail_after_irq:
+	free_irq(detector->irq, detector);
 fail_after_gpio:
-	gpio_free(ac_zc_gpio);
+	gpio_free(detector->gpio);
+fail_safe:
+	return status;
+}
+
+static void ac_zc_detector_release(struct ac_zc_detector *detector)
+{
+	device_unregister(detector->dev);
+	if(detector->source != AC_ZC_SOURCE_GPIO)
+	{
+		if(detector->source == AC_ZC_SOURCE_REPLAY)
+			ac_zc_replay_detector = NULL;
+		hrtimer_cancel(&detector->timer);
+		return;
+	}
+	irq_set_affinity_hint(detector->irq, NULL);
+	free_irq(detector->irq, detector);
+	gpio_free(detector->gpio);
+}
+
+int __init ac_zc_init(void)
+{
+	int status;
+	unsigned int index;
+	unsigned int count;
+	struct ac_zc_detector *detector;
+	printk(KERN_INFO "AC zc v0.1 initializing.\n");
+
+	INIT_KFIFO(ac_zc_capture);
+	INIT_KFIFO(ac_zc_replay_fifo);
+	init_irq_work(&ac_zc_trace_wake, ac_zc_trace_wake_up);
+
+	BUILD_BUG_ON(sizeof(struct ac_zc_status) > PAGE_SIZE);
+	ac_zc_status_page = (struct ac_zc_status *)get_zeroed_page(GFP_KERNEL);
+	if(!ac_zc_status_page)
+		return -ENOMEM;
+
+	status = class_register(&ac_zc_class);
+	if(status < 0)
+		goto fail_after_page;
+
+	// virtual then replay detectors come after real ones
+	count = ac_zc_gpio_count;
+	if(ac_zc_virtual_freq)
+		++count;
+	if(ac_zc_replay)
+		++count;
+
+	status = -EINVAL;
+	if(count == 0 || count > AC_ZC_MAX_DETECTORS)
+		goto fail_after_class;
+
+	for(index = 0; index < count; ++index)
+	{
+		detector = &ac_zc_detectors[index];
+		detector->index = index;
+		if(index < ac_zc_gpio_count)
+			detector->source = AC_ZC_SOURCE_GPIO;
+		else if(ac_zc_virtual_freq && index == ac_zc_gpio_count)
+			detector->source = AC_ZC_SOURCE_VIRTUAL;
+		else
+			detector->source = AC_ZC_SOURCE_REPLAY;
+		detector->gpio = index < ac_zc_gpio_count ? ac_zc_gpio[index] : -1;
+		detector->irq = -1;
+		detector->cpu = -1;
+		detector->last_cpu = -1;
+		detector->gpio_previous_value = 0;
+		detector->last_enter = ktime_set(0,0);
+		detector->last_leave = ktime_set(0,0);
+		detector->crossing = ktime_set(0,0);
+		detector->freq_start = get_now_secs();
+		ac_zc_status_page->count = index + 1;
+
+		// counted first so that the IRQ handler accepts this detector
+		ac_zc_detector_count = index + 1;
+
+		status = ac_zc_detector_setup(detector);
+		if(status < 0)
+			goto fail_after_detectors;
+	}
+
+	status = misc_register(&ac_zc_trace_device);
+	if(status < 0)
+		goto fail_after_detectors;
+
+	status = misc_register(&ac_zc_status_device);
+	if(status < 0)
+		goto fail_after_trace;
+
+	printk(KERN_INFO "AC zc initialized.\n");
+	return 0;
+
+fail_after_trace:
+	misc_deregister(&ac_zc_trace_device);
+fail_after_detectors:
+	ac_zc_detector_count = index;
+	while(index-- > 0)
+		ac_zc_detector_release(&ac_zc_detectors[index]);
+	ac_zc_detector_count = 0;
 fail_after_class:
 	class_unregister(&ac_zc_class);
-fail_safe:
+fail_after_page:
+	free_page((unsigned long)ac_zc_status_page);
 	return status;
 }
 
 void __exit ac_zc_exit(void)
 {
-	free_irq(ac_zc_irq, &ac_zc_class);
-	gpio_free(ac_zc_gpio);
+	unsigned int index;
+
+	misc_deregister(&ac_zc_status_device);
+	misc_deregister(&ac_zc_trace_device);
+
+	for(index = 0; index < ac_zc_detector_count; ++index)
+		ac_zc_detector_release(&ac_zc_detectors[index]);
+	ac_zc_detector_count = 0;
+	irq_work_sync(&ac_zc_trace_wake);
 
 	class_unregister(&ac_zc_class);
+	free_page((unsigned long)ac_zc_status_page);
 	printk(KERN_INFO "AC zc disabled.\n");
 }
@@ -0,0 +1,55 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Userspace runner of the driver unit tests : the kernel API floor of
+ * the drivers (pre 4.10) predates KUnit, so hardware-free units are
+ * built against the stand-in headers of tests/include instead.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ac_test.h"
+
+int ac_test_failed;
+
+void ac_test_fail(const char *file, int line, const char *expr, long long left, long long right)
+{
+	fprintf(stderr, "%s:%d: check failed: %s (%lld, %lld)\n", file, line, expr, left, right);
+	ac_test_failed = 1;
+}
+
+static int run_suite(const char *suite, const struct ac_test *tests)
+{
+	int failures = 0;
+
+	for(; tests->name; ++tests)
+	{
+		ac_test_failed = 0;
+		tests->run();
+		printf("%s %s.%s\n", ac_test_failed ? "FAIL" : "ok  ", suite, tests->name);
+		failures += ac_test_failed;
+	}
+
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int failures = 0;
+
+	if(argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		dimmer_sched_bench();
+		return 0;
+	}
+
+	failures += run_suite("dimmer_sched", dimmer_sched_tests);
+	failures += run_suite("button_debounce", button_debounce_tests);
+	failures += run_suite("dimmer_sr", dimmer_sr_tests);
+
+	printf("%d failure(s)\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#ifndef __MYLIFE_AC_TEST_H__
+#define __MYLIFE_AC_TEST_H__
+
+/* Minimal test harness for the hardware-free driver units.
+ * A check failure is reported and fails its test, which goes on.
+ */
+
+struct ac_test
+{
+	const char *name;
+	void (*run)(void);
+};
+
+extern int ac_test_failed;
+
+void ac_test_fail(const char *file, int line, const char *expr, long long left, long long right);
+
+#define AC_CHECK(cond) \
+	do { if(!(cond)) ac_test_fail(__FILE__, __LINE__, #cond, 0, 0); } while(0)
+
+#define AC_CHECK_EQ(left, right) \
+	do { long long _l = (left); long long _r = (right); \
+		if(_l != _r) ac_test_fail(__FILE__, __LINE__, #left " == " #right, _l, _r); } while(0)
+
+// suites, NULL terminated
+extern const struct ac_test dimmer_sched_tests[];
+extern const struct ac_test button_debounce_tests[];
+extern const struct ac_test dimmer_sr_tests[];
+
+// channels fired per 100us by the scheduling code, for 1 to 256 channels
+void dimmer_sched_bench(void);
+
+#endif // __MYLIFE_AC_TEST_H__
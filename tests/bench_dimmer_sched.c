@@ -0,0 +1,108 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Cost of the firing schedule per half period, for 1 to 256 channels:
+ * each crossing schedules all channels, then the run queue is drained
+ * as the engine timer would, with the default batch window, gate slack
+ * and firing grid. Reported as CSV, with the timer runs per half period
+ * and the channels handled per 100us of CPU time.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "ac_dimmer_sched.h"
+#include "ac_test.h"
+
+#define HALF_PERIOD 10000000
+#define BATCH_NS 20000
+#define SLACK_NS 50000
+#define SLOTS 200
+#define MAX_CHANNELS 256
+#define HALF_PERIODS 2000
+
+static struct dimmer_zc zcd;
+static struct dimmer_desc descs[MAX_CHANNELS];
+static struct dimmer_desc *items[MAX_CHANNELS];
+
+static s64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// return : timer runs
+static unsigned int half_period(struct dimmer_run_queue *queue, unsigned int channels, ktime_t crossing)
+{
+	struct dimmer_desc *desc;
+	ktime_t limit;
+	unsigned int index;
+	unsigned int runs = 0;
+
+	queue->count = 0;
+	for(index = 0; index < channels; ++index)
+	{
+		dimmer_sched_crossing(&descs[index], &zcd, HALF_PERIOD, crossing, crossing);
+		if(descs[index].next_tick.tv64)
+			dimmer_run_queue_insert(queue, &descs[index]);
+	}
+
+	while(queue->count)
+	{
+		limit = ktime_add_ns(dimmer_run_queue_expiry(queue, SLACK_NS), BATCH_NS);
+		++runs;
+		while((desc = dimmer_run_queue_pop(queue, limit)))
+		{
+			dimmer_sched_toggle(desc);
+			if(desc->next_tick.tv64)
+				dimmer_run_queue_insert(queue, desc);
+		}
+	}
+
+	return runs;
+}
+
+void dimmer_sched_bench(void)
+{
+	struct dimmer_run_queue queue = { .items = items, .count = 0 };
+	unsigned int channels;
+	unsigned int index;
+	unsigned int run;
+	unsigned int runs;
+	s64 start;
+	s64 elapsed;
+
+	memset(&zcd, 0, sizeof(zcd));
+	zcd.slots = SLOTS;
+	dimmer_delay_table_update(&zcd, HALF_PERIOD);
+
+	printf("channels,ns_per_half_period,timer_runs_per_half_period,channels_per_100us\n");
+	for(channels = 1; channels <= MAX_CHANNELS; channels *= 2)
+	{
+		for(index = 0; index < channels; ++index)
+		{
+			memset(&descs[index], 0, sizeof(descs[index]));
+			descs[index].value = 1 + (index * 37) % 99; // spread firing times
+			descs[index].curve = index & 1;
+			descs[index].pulse_width = DIMMER_GATE_PULSE;
+			descs[index].pulse_count = 1;
+		}
+
+		runs = 0;
+		start = now_ns();
+		for(run = 0; run < HALF_PERIODS; ++run)
+			runs += half_period(&queue, channels, ns_to_ktime((s64)run * HALF_PERIOD));
+		elapsed = (now_ns() - start) / HALF_PERIODS;
+
+		printf("%u,%lld,%u,%lld\n", channels, (long long)elapsed, runs / HALF_PERIODS,
+			elapsed ? (long long)channels * 100000 / elapsed : 0);
+	}
+}
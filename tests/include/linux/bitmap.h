@@ -0,0 +1,28 @@
+/* Userspace stand-in of the kernel header, see tests/Makefile.
+ */
+#ifndef __AC_TEST_LINUX_BITMAP_H__
+#define __AC_TEST_LINUX_BITMAP_H__
+
+#include <string.h>
+#include <limits.h>
+
+#define BITS_PER_LONG (sizeof(long) * CHAR_BIT)
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void bitmap_zero(unsigned long *dst, unsigned int nbits)
+{
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(long));
+}
+
+static inline int test_bit(unsigned int nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline void __change_bit(unsigned int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] ^= 1UL << (nr % BITS_PER_LONG);
+}
+
+#endif // __AC_TEST_LINUX_BITMAP_H__
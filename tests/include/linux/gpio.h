@@ -0,0 +1,16 @@
+/* Userspace stand-in of the kernel header, see tests/Makefile.
+ * The functions are implemented by the test of the unit using them.
+ */
+#ifndef __AC_TEST_LINUX_GPIO_H__
+#define __AC_TEST_LINUX_GPIO_H__
+
+struct gpio_desc;
+
+int gpio_request(unsigned int gpio, const char *label);
+void gpio_free(unsigned int gpio);
+struct gpio_desc *gpio_to_desc(unsigned int gpio);
+int desc_to_gpio(const struct gpio_desc *desc);
+int gpiod_direction_output_raw(struct gpio_desc *desc, int value);
+void gpiod_set_raw_value(struct gpio_desc *desc, int value);
+
+#endif // __AC_TEST_LINUX_GPIO_H__
@@ -0,0 +1,36 @@
+/* Userspace stand-in of the kernel header, only what the
+ * hardware-free driver units need, see tests/Makefile.
+ */
+#ifndef __AC_TEST_LINUX_KERNEL_H__
+#define __AC_TEST_LINUX_KERNEL_H__
+
+#include <stdlib.h>
+#include <errno.h>
+#include <linux/types.h>
+
+#define S32_MAX ((s32)0x7fffffff)
+#define S32_MIN (-S32_MAX - 1)
+#define S64_MAX ((s64)0x7fffffffffffffffLL)
+
+#define min(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); _x < _y ? _x : _y; })
+#define max(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); _x > _y ? _x : _y; })
+#define min_t(type, x, y) ({ type _x = (x); type _y = (y); _x < _y ? _x : _y; })
+#define max_t(type, x, y) ({ type _x = (x); type _y = (y); _x > _y ? _x : _y; })
+#define clamp(val, lo, hi) min(max(val, lo), hi)
+
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile typeof(x) *)&(x) = (val))
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define roundup(x, y) ((((x) + ((y) - 1)) / (y)) * (y))
+
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+#define printk(...) do { } while(0)
+#define pr_debug(...) do { } while(0)
+#define KERN_INFO ""
+
+#endif // __AC_TEST_LINUX_KERNEL_H__
@@ -0,0 +1,47 @@
+/* Userspace stand-in of the kernel header : the pre-4.10 ktime_t,
+ * times are given by the tests so there is no clock.
+ */
+#ifndef __AC_TEST_LINUX_KTIME_H__
+#define __AC_TEST_LINUX_KTIME_H__
+
+#include <linux/types.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+typedef union
+{
+	s64 tv64;
+} ktime_t;
+
+static inline ktime_t ns_to_ktime(s64 ns)
+{
+	ktime_t kt = { .tv64 = ns };
+	return kt;
+}
+
+static inline ktime_t ktime_set(s64 secs, unsigned long nsecs)
+{
+	return ns_to_ktime(secs * NSEC_PER_SEC + nsecs);
+}
+
+static inline s64 ktime_to_ns(ktime_t kt)
+{
+	return kt.tv64;
+}
+
+static inline ktime_t ktime_add_ns(ktime_t kt, u64 nsec)
+{
+	return ns_to_ktime(kt.tv64 + nsec);
+}
+
+static inline ktime_t ktime_add(ktime_t a, ktime_t b)
+{
+	return ns_to_ktime(a.tv64 + b.tv64);
+}
+
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b)
+{
+	return ns_to_ktime(a.tv64 - b.tv64);
+}
+
+#endif // __AC_TEST_LINUX_KTIME_H__
@@ -0,0 +1,17 @@
+/* Userspace stand-in of the kernel header */
+#ifndef __AC_TEST_LINUX_MATH64_H__
+#define __AC_TEST_LINUX_MATH64_H__
+
+#include <linux/types.h>
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+	return dividend / divisor;
+}
+
+#endif // __AC_TEST_LINUX_MATH64_H__
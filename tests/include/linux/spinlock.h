@@ -0,0 +1,18 @@
+/* Userspace stand-in of the kernel header, see tests/Makefile.
+ * Tests are single threaded : locks only check their pairing.
+ */
+#ifndef __AC_TEST_LINUX_SPINLOCK_H__
+#define __AC_TEST_LINUX_SPINLOCK_H__
+
+#include <stdlib.h>
+
+typedef struct { int locked; } raw_spinlock_t;
+
+#define DEFINE_RAW_SPINLOCK(name) raw_spinlock_t name = { 0 }
+
+#define raw_spin_lock_irqsave(lock, flags) \
+	do { (flags) = 0; if((lock)->locked++) abort(); } while(0)
+#define raw_spin_unlock_irqrestore(lock, flags) \
+	do { (void)(flags); if(--(lock)->locked) abort(); } while(0)
+
+#endif // __AC_TEST_LINUX_SPINLOCK_H__
@@ -0,0 +1,7 @@
+/* Userspace stand-in of the kernel header */
+#ifndef __AC_TEST_LINUX_STRING_H__
+#define __AC_TEST_LINUX_STRING_H__
+
+#include <string.h>
+
+#endif // __AC_TEST_LINUX_STRING_H__
@@ -0,0 +1,23 @@
+/* Userspace stand-in of the kernel header, only what the
+ * hardware-free driver units need, see tests/Makefile.
+ */
+#ifndef __AC_TEST_LINUX_TYPES_H__
+#define __AC_TEST_LINUX_TYPES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef uint32_t __u32;
+typedef int32_t __s32;
+typedef uint64_t __u64;
+
+#endif // __AC_TEST_LINUX_TYPES_H__
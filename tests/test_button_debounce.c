@@ -0,0 +1,99 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Tests of the button debounce logic, on a fake clock.
+*/
+
+#include <string.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "ac_button_debounce.h"
+#include "ac_test.h"
+
+#define INTERVAL 50000000 // sampling interval
+
+static struct button_desc desc;
+
+// one sampling interval ending at interval * INTERVAL, an edge at offset if >= 0
+static int sample(int interval, s64 offset)
+{
+	if(offset >= 0)
+		button_edge(&desc, ns_to_ktime((s64)(interval - 1) * INTERVAL + offset));
+	return button_debounce(&desc, ns_to_ktime((s64)interval * INTERVAL));
+}
+
+static void test_press_release(void)
+{
+	memset(&desc, 0, sizeof(desc));
+
+	// a single interval with interrupts is noise
+	AC_CHECK_EQ(sample(1, 1000), 0);
+	AC_CHECK_EQ(desc.value, 0);
+	AC_CHECK_EQ(sample(2, -1), 0);
+
+	// pressed after MIN_RANGE_COUNT contiguous intervals
+	AC_CHECK_EQ(sample(3, 1000), 0);
+	AC_CHECK_EQ(sample(4, 1000), 1);
+	AC_CHECK_EQ(desc.value, 1);
+	AC_CHECK_EQ(desc.presses, 1);
+	AC_CHECK_EQ(sample(5, 1000), 0);
+
+	// released after the first interval without
+	AC_CHECK_EQ(sample(6, -1), 1);
+	AC_CHECK_EQ(desc.value, 0);
+	AC_CHECK_EQ(desc.press_start.tv64, 0);
+	AC_CHECK_EQ(desc.presses, 1);
+}
+
+static void test_latency(void)
+{
+	memset(&desc, 0, sizeof(desc));
+
+	// from the first interrupt of the press to its report
+	sample(1, 30000000);
+	sample(2, 0);
+	AC_CHECK_EQ(desc.value, 1);
+	AC_CHECK_EQ(desc.latency, INTERVAL - 30000000 + INTERVAL);
+	AC_CHECK_EQ(desc.latency_max, desc.latency);
+
+	sample(3, -1);
+	sample(4, 1000);
+	sample(5, 1000);
+	AC_CHECK_EQ(desc.presses, 2);
+	AC_CHECK_EQ(desc.latency, 2 * INTERVAL - 1000);
+	AC_CHECK_EQ(desc.latency_max, 2 * INTERVAL - 1000);
+}
+
+// a held press (simulated one) interrupts again right after each sample
+static void test_held(void)
+{
+	int interval;
+
+	memset(&desc, 0, sizeof(desc));
+
+	button_edge(&desc, ns_to_ktime(20000000));
+	AC_CHECK_EQ(button_debounce(&desc, ns_to_ktime(INTERVAL)), 0);
+	for(interval = 2; interval <= 12; ++interval)
+	{
+		button_edge(&desc, ns_to_ktime((s64)(interval - 1) * INTERVAL));
+		AC_CHECK_EQ(button_debounce(&desc, ns_to_ktime((s64)interval * INTERVAL)), interval == 2);
+	}
+
+	// later edges do not move the press start
+	AC_CHECK_EQ(desc.press_start.tv64, 20000000);
+	AC_CHECK_EQ(desc.latency, 2 * INTERVAL - 20000000);
+	AC_CHECK_EQ(desc.presses, 1);
+	AC_CHECK_EQ(desc.value, 1);
+}
+
+const struct ac_test button_debounce_tests[] =
+{
+	{ "press_release", test_press_release },
+	{ "latency", test_latency },
+	{ "held", test_held },
+	{ NULL, NULL },
+};
@@ -0,0 +1,485 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Tests of the dimmer firing schedule, on a fake clock.
+*/
+
+#include <string.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+
+#include "ac_button.h"
+#include "ac_dimmer_sched.h"
+#include "ac_test.h"
+
+#define HALF_PERIOD 10000000 // 50Hz
+#define T0 1000000000LL
+
+static struct dimmer_zc zcd;
+
+static void zc_setup(void)
+{
+	memset(&zcd, 0, sizeof(zcd));
+	dimmer_delay_table_update(&zcd, HALF_PERIOD);
+}
+
+// same defaults as dimmer_export()
+static void desc_setup(struct dimmer_desc *desc, int value, int mode)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->value = value;
+	desc->curve = DIMMER_CURVE_LINEAR;
+	desc->mode = mode;
+	desc->pulse_width = DIMMER_GATE_PULSE;
+	desc->pulse_count = 1;
+	desc->pulse_period = 2 * DIMMER_GATE_PULSE;
+	desc->binding.fade_dir = -1;
+}
+
+static void test_delay_table(void)
+{
+	zc_setup();
+	AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_LINEAR][50], HALF_PERIOD / 2);
+	AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_LINEAR][0], HALF_PERIOD / 10 * 9);
+	AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_POWER][50], HALF_PERIOD / 2);
+	AC_CHECK(zcd.delay_table[DIMMER_CURVE_POWER][25] > zcd.delay_table[DIMMER_CURVE_POWER][75]);
+
+	// small drift keeps the table, larger one rebuilds it
+	dimmer_delay_table_update(&zcd, HALF_PERIOD + 1000);
+	AC_CHECK_EQ(zcd.delay_table_period, HALF_PERIOD);
+	dimmer_delay_table_update(&zcd, HALF_PERIOD + 100000);
+	AC_CHECK_EQ(zcd.delay_table_period, HALF_PERIOD + 100000);
+	AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_LINEAR][50], (HALF_PERIOD + 100000) / 2);
+}
+
+static void test_slot_grid(void)
+{
+	struct dimmer_desc desc;
+	u32 slot = HALF_PERIOD / 200;
+	int value;
+
+	memset(&zcd, 0, sizeof(zcd));
+	zcd.slots = 200;
+	dimmer_delay_table_update(&zcd, HALF_PERIOD);
+	AC_CHECK_EQ(zcd.slot, slot);
+
+	// linear values are already on the grid, power ones are rounded to it
+	AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_LINEAR][37], HALF_PERIOD / 100 * 63);
+	for(value = 0; value <= 100; ++value)
+		AC_CHECK_EQ(zcd.delay_table[DIMMER_CURVE_POWER][value] % slot, 0);
+	AC_CHECK(zcd.delay_table[DIMMER_CURVE_POWER][33] != zcd.delay_table[DIMMER_CURVE_POWER][34]);
+
+	// pulses are made longer up to the grid, and kept apart in a train
+	desc_setup(&desc, 50, DIMMER_MODE_LEADING);
+	desc.pulse_width = 120000;
+	desc.pulse_count = 2;
+	desc.pulse_period = 130000;
+	dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD / 2);
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD / 2 + 150000);
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD / 2 + 200000);
+
+	// trailing edge cut off, down to the grid
+	desc_setup(&desc, 33, DIMMER_MODE_TRAILING);
+	desc.curve = DIMMER_CURVE_POWER;
+	dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	AC_CHECK_EQ((desc.next_tick.tv64 - T0) % slot, 0);
+	AC_CHECK(desc.next_tick.tv64 - T0 <= HALF_PERIOD - zcd.delay_table[DIMMER_CURVE_POWER][33]);
+}
+
+/* Every value, curve and mode, drained as the engine timer does :
+ * timer runs per half period are bounded by the grid, not the channels.
+ */
+#define GRID_CHANNELS (101 * DIMMER_CURVE_COUNT * 2)
+#define GRID_SLOTS 50
+
+static void test_slot_grid_bound(void)
+{
+	static struct dimmer_desc descs[GRID_CHANNELS];
+	static struct dimmer_desc *items[GRID_CHANNELS];
+	struct dimmer_run_queue queue = { .items = items, .count = 0 };
+	struct dimmer_desc *desc;
+	ktime_t limit;
+	unsigned int index;
+	unsigned int runs = 0;
+
+	memset(&zcd, 0, sizeof(zcd));
+	zcd.slots = GRID_SLOTS;
+	dimmer_delay_table_update(&zcd, HALF_PERIOD);
+
+	for(index = 0; index < GRID_CHANNELS; ++index)
+	{
+		desc_setup(&descs[index], index % 101, index / 202 ? DIMMER_MODE_TRAILING : DIMMER_MODE_LEADING);
+		descs[index].curve = index / 101 % 2;
+		descs[index].pulse_width = 100000 + index * 1000;
+		dimmer_sched_crossing(&descs[index], &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+		if(descs[index].next_tick.tv64)
+			dimmer_run_queue_insert(&queue, &descs[index]);
+	}
+
+	while(queue.count)
+	{
+		limit = ktime_add_ns(dimmer_run_queue_expiry(&queue, 50000), 20000);
+		++runs;
+		while((desc = dimmer_run_queue_pop(&queue, limit)))
+		{
+			dimmer_sched_toggle(desc);
+			if(desc->next_tick.tv64)
+				dimmer_run_queue_insert(&queue, desc);
+		}
+	}
+
+	AC_CHECK(runs <= GRID_SLOTS + 1);
+}
+
+static void test_leading(void)
+{
+	struct dimmer_desc desc;
+
+	zc_setup();
+	desc_setup(&desc, 50, DIMMER_MODE_LEADING);
+
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD / 2);
+
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD / 2 + DIMMER_GATE_PULSE);
+
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+}
+
+static void test_full_on_off(void)
+{
+	struct dimmer_desc desc;
+
+	zc_setup();
+	desc_setup(&desc, 100, DIMMER_MODE_LEADING);
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+
+	desc_setup(&desc, 0, DIMMER_MODE_LEADING);
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+
+	// no period measured yet
+	desc_setup(&desc, 50, DIMMER_MODE_LEADING);
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, 0, ns_to_ktime(T0), ns_to_ktime(T0)), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+}
+
+static void test_trailing(void)
+{
+	struct dimmer_desc desc;
+
+	zc_setup();
+	desc_setup(&desc, 30, DIMMER_MODE_TRAILING);
+
+	// conducts as long as leading edge would, from the crossing
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD - zcd.delay_table[DIMMER_CURVE_LINEAR][30]);
+
+	// single cut off event
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+
+	// cut off kept a gate pulse before the next crossing
+	desc_setup(&desc, 99, DIMMER_MODE_TRAILING);
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + HALF_PERIOD - DIMMER_GATE_PULSE);
+}
+
+static void test_trailing_level_leave(void)
+{
+	struct dimmer_desc desc;
+	struct dimmer_desc leading;
+	u32 cutoff;
+
+	zc_setup();
+	desc_setup(&desc, 30, DIMMER_MODE_TRAILING);
+	cutoff = HALF_PERIOD - zcd.delay_table[DIMMER_CURVE_LINEAR][30];
+
+	// level detector leave edge, its offset before the crossing : on at the crossing
+	AC_CHECK_EQ(dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0 - 200000)), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0);
+
+	// accounted as conducting, like its leading edge counterpart
+	dimmer_sched_account(&desc, 0);
+	desc_setup(&leading, 30, DIMMER_MODE_LEADING);
+	dimmer_sched_account(&leading, dimmer_sched_crossing(&leading, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0)));
+	AC_CHECK(desc.energy != 0);
+	AC_CHECK_EQ(desc.energy, leading.energy);
+
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 1);
+	AC_CHECK_EQ(desc.next_tick.tv64, T0 + cutoff);
+
+	AC_CHECK_EQ(dimmer_sched_toggle(&desc), 0);
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+}
+
+static void test_pulse_train(void)
+{
+	struct dimmer_desc desc;
+	s64 fire;
+	int pulse;
+
+	zc_setup();
+	desc_setup(&desc, 50, DIMMER_MODE_LEADING);
+	desc.pulse_width = 100000;
+	desc.pulse_count = 3;
+	desc.pulse_period = 500000;
+
+	dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	fire = T0 + HALF_PERIOD / 2;
+
+	for(pulse = 0; pulse < 3; ++pulse)
+	{
+		AC_CHECK_EQ(desc.next_tick.tv64, fire + pulse * 500000);
+		AC_CHECK_EQ(dimmer_sched_toggle(&desc), 1);
+		AC_CHECK_EQ(desc.next_tick.tv64, fire + pulse * 500000 + 100000);
+		AC_CHECK_EQ(dimmer_sched_toggle(&desc), 0);
+	}
+	AC_CHECK_EQ(desc.next_tick.tv64, 0);
+}
+
+static void test_burst(void)
+{
+	struct dimmer_desc desc;
+	int levels[16];
+	int crossing;
+	ktime_t time;
+	int on = 0;
+
+	zc_setup();
+	desc_setup(&desc, 25, DIMMER_MODE_BURST);
+
+	for(crossing = 0; crossing < 16; ++crossing)
+	{
+		time = ns_to_ktime(T0 + crossing * HALF_PERIOD);
+		levels[crossing] = dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, time, time);
+		AC_CHECK_EQ(desc.next_tick.tv64, 0);
+		on += levels[crossing];
+	}
+
+	// whole cycles, a quarter of them, evenly spread
+	AC_CHECK_EQ(on, 4);
+	for(crossing = 0; crossing < 16; crossing += 2)
+		AC_CHECK_EQ(levels[crossing], levels[crossing + 1]);
+	AC_CHECK_EQ(levels[6], 1);
+	AC_CHECK_EQ(levels[14], 1);
+}
+
+static void test_run_queue(void)
+{
+	struct dimmer_desc descs[4];
+	struct dimmer_desc *items[4];
+	struct dimmer_run_queue queue = { .items = items, .count = 0 };
+	static const s64 ticks[4] = { 30, 10, 40, 20 };
+	int index;
+
+	for(index = 0; index < 4; ++index)
+	{
+		desc_setup(&descs[index], 50, DIMMER_MODE_LEADING);
+		descs[index].zc = index & 1;
+		descs[index].next_tick = ns_to_ktime(ticks[index]);
+		dimmer_run_queue_insert(&queue, &descs[index]);
+	}
+
+	AC_CHECK_EQ(dimmer_run_queue_next(&queue).tv64, 10);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(9)) == NULL);
+
+	// earliest first, up to the limit
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(25)) == &descs[1]);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(25)) == &descs[3]);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(25)) == NULL);
+
+	dimmer_run_queue_remove(&queue, &descs[0]);
+	AC_CHECK_EQ(queue.count, 1);
+	AC_CHECK_EQ(descs[0].next_tick.tv64, 0);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(100)) == &descs[2]);
+	AC_CHECK_EQ(dimmer_run_queue_next(&queue).tv64, 0);
+
+	// dropping a phase keeps the others, in order
+	for(index = 0; index < 4; ++index)
+	{
+		descs[index].next_tick = ns_to_ktime(ticks[index]);
+		dimmer_run_queue_insert(&queue, &descs[index]);
+	}
+	dimmer_run_queue_drop_zc(&queue, 1);
+	AC_CHECK_EQ(queue.count, 2);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(100)) == &descs[0]);
+	AC_CHECK(dimmer_run_queue_pop(&queue, ns_to_ktime(100)) == &descs[2]);
+}
+
+static void test_run_queue_expiry(void)
+{
+	struct dimmer_desc off, on, cut;
+	struct dimmer_desc *items[3];
+	struct dimmer_run_queue queue = { .items = items, .count = 0 };
+
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 50000).tv64, 0);
+
+	// gate pulse end, riding a gate on within the slack
+	desc_setup(&off, 50, DIMMER_MODE_LEADING);
+	off.gpio_value = 1;
+	off.pulse_left = 1;
+	off.next_tick = ns_to_ktime(100000);
+	desc_setup(&on, 50, DIMMER_MODE_LEADING);
+	on.next_tick = ns_to_ktime(130000);
+	dimmer_run_queue_insert(&queue, &off);
+	dimmer_run_queue_insert(&queue, &on);
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 50000).tv64, 130000);
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 0).tv64, 100000);
+
+	// too far : late by the slack only
+	dimmer_run_queue_remove(&queue, &on);
+	on.next_tick = ns_to_ktime(200000);
+	dimmer_run_queue_insert(&queue, &on);
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 50000).tv64, 150000);
+
+	// in a train, well before the next pulse
+	off.pulse_left = 2;
+	off.pulse_width = 300000;
+	off.pulse_period = 400000;
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 50000).tv64, 125000);
+
+	// trailing edge cut off is the dimming itself : exact
+	desc_setup(&cut, 50, DIMMER_MODE_TRAILING);
+	cut.gpio_value = 1;
+	cut.next_tick = ns_to_ktime(90000);
+	dimmer_run_queue_insert(&queue, &cut);
+	AC_CHECK_EQ(dimmer_run_queue_expiry(&queue, 50000).tv64, 90000);
+}
+
+static void test_binding_toggle_step(void)
+{
+	struct dimmer_binding binding;
+
+	memset(&binding, 0, sizeof(binding));
+	binding.action = DIMMER_BINDING_TOGGLE;
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 60), 0);
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 0), 60);
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_RELEASE, 60), 60);
+
+	// never on before : full on
+	memset(&binding, 0, sizeof(binding));
+	binding.action = DIMMER_BINDING_TOGGLE;
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 0), 100);
+
+	memset(&binding, 0, sizeof(binding));
+	binding.action = DIMMER_BINDING_STEP;
+	binding.arg = 40;
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 0), 40);
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 80), 100);
+	AC_CHECK_EQ(dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 100), 0);
+}
+
+static void test_binding_fade(void)
+{
+	struct dimmer_binding binding;
+	int value = 50;
+
+	memset(&binding, 0, sizeof(binding));
+	binding.action = DIMMER_BINDING_FADE;
+	binding.arg = 2;
+	binding.fade_dir = -1;
+
+	// held : fades, reversing at each hold
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, value);
+	AC_CHECK_EQ(value, 50);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_HOLD, value);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_HOLD, value);
+	AC_CHECK_EQ(value, 54);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_RELEASE, value);
+	AC_CHECK_EQ(value, 54);
+
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, value);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_HOLD, value);
+	AC_CHECK_EQ(value, 52);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_RELEASE, value);
+
+	// short press toggles
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, value);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_RELEASE, value);
+	AC_CHECK_EQ(value, 0);
+
+	// at a bound, fades away from it
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_PRESS, 100);
+	value = dimmer_binding_action(&binding, AC_BUTTON_STATUS_HOLD, value);
+	AC_CHECK_EQ(value, 98);
+}
+
+static void test_jitter(void)
+{
+	struct dimmer_jitter jitter;
+
+	dimmer_jitter_reset(&jitter);
+	dimmer_jitter_record(&jitter, 1, 500);
+	dimmer_jitter_record(&jitter, 1, 3000);
+	dimmer_jitter_record(&jitter, 1, -2000);
+	dimmer_jitter_record(&jitter, 0, 1LL << 40);
+
+	AC_CHECK_EQ(jitter.count[1], 3);
+	AC_CHECK_EQ(jitter.buckets[1][0], 1);
+	AC_CHECK_EQ(jitter.buckets[1][2], 1);
+	AC_CHECK_EQ(jitter.early[1], 1);
+	AC_CHECK_EQ(jitter.min[1], -2000);
+	AC_CHECK_EQ(jitter.max[1], 3000);
+	AC_CHECK_EQ(jitter.max[0], S32_MAX);
+	AC_CHECK_EQ(jitter.buckets[0][DIMMER_JITTER_BUCKETS - 1], 1);
+}
+
+static void test_account(void)
+{
+	struct dimmer_desc desc;
+	int level;
+
+	zc_setup();
+	desc_setup(&desc, 50, DIMMER_MODE_LEADING);
+	level = dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	dimmer_sched_account(&desc, level);
+	AC_CHECK_EQ(desc.energy, 32768);
+
+	desc_setup(&desc, 100, DIMMER_MODE_LEADING);
+	level = dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	dimmer_sched_account(&desc, level);
+	AC_CHECK_EQ(desc.energy, 65536);
+
+	desc_setup(&desc, 0, DIMMER_MODE_LEADING);
+	level = dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	dimmer_sched_account(&desc, level);
+	AC_CHECK_EQ(desc.energy, 0);
+	AC_CHECK_EQ(desc.half_cycles, 1);
+
+	// power curve value is the conducted power
+	desc_setup(&desc, 25, DIMMER_MODE_TRAILING);
+	desc.curve = DIMMER_CURVE_POWER;
+	level = dimmer_sched_crossing(&desc, &zcd, HALF_PERIOD, ns_to_ktime(T0), ns_to_ktime(T0));
+	dimmer_sched_account(&desc, level);
+	AC_CHECK_EQ(desc.energy, 16384);
+}
+
+const struct ac_test dimmer_sched_tests[] =
+{
+	{ "delay_table", test_delay_table },
+	{ "slot_grid", test_slot_grid },
+	{ "slot_grid_bound", test_slot_grid_bound },
+	{ "leading", test_leading },
+	{ "full_on_off", test_full_on_off },
+	{ "trailing", test_trailing },
+	{ "trailing_level_leave", test_trailing_level_leave },
+	{ "pulse_train", test_pulse_train },
+	{ "burst", test_burst },
+	{ "run_queue", test_run_queue },
+	{ "run_queue_expiry", test_run_queue_expiry },
+	{ "binding_toggle_step", test_binding_toggle_step },
+	{ "binding_fade", test_binding_fade },
+	{ "jitter", test_jitter },
+	{ "account", test_account },
+	{ NULL, NULL },
+};
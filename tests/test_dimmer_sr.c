@@ -0,0 +1,268 @@
+/* Copyright (C) 2014 Vincent TRUMPFF
+ *
+ * May be copied or modified under the terms of the GNU General Public
+ * License. See linux/COPYING for more information.
+ *
+ * Tests of the shift register backend, against a software model of a
+ * 74HC595 chain wired to the GPIO stand-ins : the latched word is
+ * checked after each batch of output changes.
+*/
+
+#include <string.h>
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/gpio.h>
+
+#include "ac_dimmer_sched.h"
+#include "ac_dimmer_sr.h"
+#include "ac_test.h"
+
+#define PIN_DATA 2
+#define PIN_CLOCK 3
+#define PIN_LATCH 4
+#define PIN_COUNT 8
+
+struct gpio_desc
+{
+	unsigned int gpio;
+	int requested;
+	int output;
+	int value;
+};
+
+/* 74HC595 chain : on a clock rising edge every stage shifts one output
+ * further from data (Qh of a register feeds the next one), on a latch
+ * rising edge the storage registers take the shift registers.
+ */
+static struct
+{
+	struct gpio_desc pins[PIN_COUNT];
+	int fail_gpio;
+	u64 shift;
+	u64 latched;
+	unsigned int clocks;
+	unsigned int latches;
+} chain;
+
+static void chain_reset(void)
+{
+	unsigned int gpio;
+
+	memset(&chain, 0, sizeof(chain));
+	for(gpio = 0; gpio < PIN_COUNT; ++gpio)
+		chain.pins[gpio].gpio = gpio;
+	chain.fail_gpio = -1;
+	chain.shift = chain.latched = ~0ULL; // power up garbage
+}
+
+int gpio_request(unsigned int gpio, const char *label)
+{
+	if(gpio >= PIN_COUNT || (int)gpio == chain.fail_gpio)
+		return -EINVAL;
+	if(chain.pins[gpio].requested)
+		return -EBUSY;
+	chain.pins[gpio].requested = 1;
+	return 0;
+}
+
+void gpio_free(unsigned int gpio)
+{
+	AC_CHECK(chain.pins[gpio].requested);
+	chain.pins[gpio].requested = 0;
+	chain.pins[gpio].output = 0;
+}
+
+struct gpio_desc *gpio_to_desc(unsigned int gpio)
+{
+	return &chain.pins[gpio];
+}
+
+int desc_to_gpio(const struct gpio_desc *desc)
+{
+	return desc->gpio;
+}
+
+int gpiod_direction_output_raw(struct gpio_desc *desc, int value)
+{
+	desc->output = 1;
+	desc->value = value;
+	return 0;
+}
+
+void gpiod_set_raw_value(struct gpio_desc *desc, int value)
+{
+	int rising = !desc->value && value;
+
+	AC_CHECK(desc->requested && desc->output);
+	desc->value = value;
+	if(!rising)
+		return;
+
+	if(desc->gpio == PIN_CLOCK)
+	{
+		chain.shift = (chain.shift << 1) | chain.pins[PIN_DATA].value;
+		++chain.clocks;
+	}
+	else if(desc->gpio == PIN_LATCH)
+	{
+		chain.latched = chain.shift;
+		++chain.latches;
+	}
+}
+
+static u64 latched(unsigned int bits)
+{
+	return chain.latched & (bits < 64 ? (1ULL << bits) - 1 : ~0ULL);
+}
+
+static void test_init_clears(void)
+{
+	chain_reset();
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 16), 0);
+	AC_CHECK_EQ(chain.latches, 1);
+	AC_CHECK_EQ(chain.clocks, 16);
+	AC_CHECK_EQ(latched(16), 0);
+	dimmer_sr_exit();
+	AC_CHECK(!chain.pins[PIN_DATA].requested && !chain.pins[PIN_CLOCK].requested && !chain.pins[PIN_LATCH].requested);
+}
+
+static void test_init_fails(void)
+{
+	chain_reset();
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 0), -EINVAL);
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, DIMMER_SR_MAX_BITS + 1), -EINVAL);
+
+	// pins already taken are released
+	chain.fail_gpio = PIN_LATCH;
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 8), -EINVAL);
+	AC_CHECK(!chain.pins[PIN_DATA].requested && !chain.pins[PIN_CLOCK].requested);
+	AC_CHECK_EQ(chain.latches, 0);
+}
+
+static void test_word(void)
+{
+	static const unsigned int bits[] = { 0, 7, 8, 13, 31, 63 };
+	u64 expected = 0;
+	unsigned int index;
+
+	chain_reset();
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 64), 0);
+
+	// bit n is Q(n % 8) of register n / 8, counted from data
+	for(index = 0; index < ARRAY_SIZE(bits); ++index)
+	{
+		dimmer_sr_set(bits[index], 1);
+		expected |= 1ULL << bits[index];
+		AC_CHECK_EQ(chain.latches, 1 + index); // nothing shifted before the flush
+		dimmer_sr_flush();
+		AC_CHECK_EQ(chain.latches, 2 + index);
+		AC_CHECK_EQ(latched(64), expected);
+	}
+
+	dimmer_sr_set(13, 0);
+	dimmer_sr_flush();
+	AC_CHECK_EQ(latched(64), expected & ~(1ULL << 13));
+	dimmer_sr_exit();
+}
+
+static void test_flush_unchanged(void)
+{
+	unsigned int clocks;
+
+	chain_reset();
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 8), 0);
+	dimmer_sr_set(3, 1);
+	dimmer_sr_flush();
+	clocks = chain.clocks;
+
+	// same levels : no pin activity
+	dimmer_sr_set(3, 1);
+	dimmer_sr_set(4, 0);
+	dimmer_sr_flush();
+	AC_CHECK_EQ(chain.clocks, clocks);
+	AC_CHECK_EQ(chain.latches, 2);
+	AC_CHECK_EQ(latched(8), 1 << 3);
+	dimmer_sr_exit();
+}
+
+/* Firing as the engine timer does it : outputs of all toggles due in
+ * the batch window are set, then shifted out once. The latched word
+ * must match the dimmer levels after every batch.
+ */
+#define BATCH_CHANNELS 12
+#define BATCH_NS 20000
+#define SLACK_NS 50000
+#define HALF_PERIOD 10000000
+
+static void test_batches(void)
+{
+	struct dimmer_zc zcd;
+	struct dimmer_desc descs[BATCH_CHANNELS];
+	struct dimmer_desc *items[BATCH_CHANNELS];
+	struct dimmer_run_queue queue = { .items = items, .count = 0 };
+	struct dimmer_desc *desc;
+	ktime_t limit;
+	u64 levels = 0;
+	unsigned int batches = 0;
+	unsigned int latches;
+	unsigned int index;
+	int level;
+
+	chain_reset();
+	memset(&zcd, 0, sizeof(zcd));
+	dimmer_delay_table_update(&zcd, HALF_PERIOD);
+	AC_CHECK_EQ(dimmer_sr_init(PIN_DATA, PIN_CLOCK, PIN_LATCH, 16), 0);
+
+	for(index = 0; index < BATCH_CHANNELS; ++index)
+	{
+		memset(&descs[index], 0, sizeof(descs[index]));
+		descs[index].value = index * 9; // includes full off, and values sharing a batch
+		descs[index].mode = index % 3 == 2 ? DIMMER_MODE_TRAILING : DIMMER_MODE_LEADING;
+		descs[index].pulse_width = DIMMER_GATE_PULSE;
+		descs[index].pulse_count = 1;
+
+		// leave edge of a level detector, ahead of the crossing
+		level = dimmer_sched_crossing(&descs[index], &zcd, HALF_PERIOD, ns_to_ktime(0), ns_to_ktime(-150000));
+		dimmer_sr_set(index, level);
+		levels = (levels & ~(1ULL << index)) | ((u64)level << index);
+		if(descs[index].next_tick.tv64)
+			dimmer_run_queue_insert(&queue, &descs[index]);
+	}
+	dimmer_sr_flush();
+	AC_CHECK_EQ(latched(16), levels);
+	latches = chain.latches;
+
+	while(queue.count)
+	{
+		limit = ktime_add_ns(dimmer_run_queue_expiry(&queue, SLACK_NS), BATCH_NS);
+		while((desc = dimmer_run_queue_pop(&queue, limit)))
+		{
+			index = desc - descs;
+			level = dimmer_sched_toggle(desc);
+			dimmer_sr_set(index, level);
+			levels = (levels & ~(1ULL << index)) | ((u64)level << index);
+			if(desc->next_tick.tv64)
+				dimmer_run_queue_insert(&queue, desc);
+		}
+		dimmer_sr_flush();
+		++batches;
+		AC_CHECK_EQ(latched(16), levels);
+	}
+
+	// every gate ends the half period off, in fewer batches than toggles
+	AC_CHECK_EQ(latched(16), 0);
+	AC_CHECK_EQ(chain.latches, latches + batches);
+	AC_CHECK(batches < 2 * BATCH_CHANNELS);
+	dimmer_sr_exit();
+}
+
+const struct ac_test dimmer_sr_tests[] =
+{
+	{ "init_clears", test_init_clears },
+	{ "init_fails", test_init_fails },
+	{ "word", test_word },
+	{ "flush_unchanged", test_flush_unchanged },
+	{ "batches", test_batches },
+	{ NULL, NULL },
+};